@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "drm-common.h"
+
+/* Beam racing: the shader renders into the single buffer being scanned out,
+ * in horizontal slices, each one while the beam scans the one above it, so
+ * that it completes before the beam reaches it, and after it has been
+ * scanned out in the previous refresh.  The scanout of each line is timed
+ * from the vblank timestamps, which mark the start of the active area, and
+ * the line timing of the mode.
+ *
+ * The framebuffer rows, as rendered to from the surfaceless framebuffer,
+ * are the scanout lines, from the top.
+ */
+
+/* Returns the time of the start of the scanout of the last vblank */
+static int last_vblank(const struct drm *drm, uint64_t *time)
+{
+	uint64_t sequence;
+
+	if (drmCrtcGetSequence(drm->fd, drm->crtc_id, &sequence, time) == 0)
+		return 0;
+
+	/* Kernels before 4.15 only have the legacy vblank ioctl */
+	drmVBlank vbl = {
+			.request = {
+					.type = DRM_VBLANK_RELATIVE |
+					        ((drm->crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+					         DRM_VBLANK_HIGH_CRTC_MASK),
+					.sequence = 0,
+			},
+	};
+	if (drmWaitVBlank(drm->fd, &vbl))
+		return -1;
+
+	*time = vbl.reply.tval_sec * NSEC_PER_SEC + vbl.reply.tval_usec * (NSEC_PER_SEC / USEC_PER_SEC);
+	return 0;
+}
+
+int beam_run(const struct gbm *gbm, const struct egl *egl)
+{
+	const struct drm *drm = gbm->drm;
+	const drmModeModeInfo *mode = drm->mode;
+	uint32_t i = 0;
+	uint64_t start_time, report_time, cur_time;
+	int ret;
+
+	/* line timing, from the pixel clock in kHz */
+	double line = mode->htotal * 1e6 / mode->clock;
+	uint64_t period = line * mode->vtotal;
+	unsigned int slices = drm->beam_slices;
+	int height = (mode->vdisplay + slices - 1) / slices;
+
+	/* slices completed after the beam reached them, i.e. torn */
+	unsigned int late = 0;
+	uint64_t late_max = 0;
+	double slack = 0;
+
+	struct drm_fb *fb = drm_fb_get_from_bo(gbm->bos[0]);
+	if (!fb) {
+		printf("Failed to get a new framebuffer BO\n");
+		return -1;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, egl->fbs[0].fb);
+
+	start_realtime();
+
+	/* The first frame is rendered as a whole, before its scanout */
+	start_time = report_time = get_time_ns();
+	egl->draw_slice(start_time, i, 0.0f, 0, mode->vdisplay);
+	glFinish();
+
+	ret = drmModeSetCrtc(drm->fd, drm->crtc_id, fb->fb_id, 0, 0,
+	                     (uint32_t *) &drm->connector_id, 1, (drmModeModeInfo *) mode);
+	if (ret) {
+		printf("Failed to set mode: %s\n", strerror(errno));
+		return ret;
+	}
+
+	printf("Racing the beam in %u slices of %d lines, %.3f us/line\n", slices, height, line / 1000.0);
+
+	while (drm->frames == 0 || i < drm->frames) {
+		uint64_t vblank, scanout;
+
+		if (i == 1) {
+			start_time = report_time = get_time_ns();
+		}
+
+		if (last_vblank(drm, &vblank)) {
+			printf("failed to get the last vblank: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* The next scanout, whose first slice can still be rendered
+		 * in time, as the beam scans the last slice of the current one
+		 */
+		cur_time = get_time_ns();
+		scanout = vblank + period;
+		while (scanout < cur_time + height * line)
+			scanout += period;
+
+		float fps = 0.0f;
+		if (i > 1) {
+			fps = (float) ((i - 1) * NSEC_PER_SEC) / (float) (cur_time - start_time);
+		}
+
+		for (unsigned int s = 0; s < slices; s++) {
+			int y = s * height;
+			uint64_t deadline = scanout + y * line;
+
+			if (wait_events_until(deadline - height * line))
+				return -1;
+			if (event_loop_interrupted())
+				return 0;
+
+			egl->draw_slice(start_time, i, fps, y, MIN2(height, mode->vdisplay - y));
+			if (finish_render(egl))
+				return -1;
+
+			cur_time = get_time_ns();
+			if (cur_time > deadline) {
+				late++;
+				late_max = MAX2(late_max, cur_time - deadline);
+			} else {
+				slack += deadline - cur_time;
+			}
+		}
+		i++;
+
+		cur_time = get_time_ns();
+		sample_gpu_stats(cur_time);
+		if (cur_time > (report_time + 2 * NSEC_PER_SEC)) {
+			double elapsed_time = cur_time - start_time;
+			double secs = elapsed_time / (double) NSEC_PER_SEC;
+			unsigned frames = i - 1;  /* first frame ignored */
+			printf("Rendered %u frames in %f sec (%f fps)\n",
+			       frames, secs, (double) frames / secs);
+			report_time = cur_time;
+		}
+	}
+
+	cur_time = get_time_ns();
+	double elapsed_time = cur_time - start_time;
+	double secs = elapsed_time / (double) NSEC_PER_SEC;
+	unsigned frames = i - 1;  /* first frame ignored */
+	printf("Rendered %u frames in %f sec (%f fps)\n",
+	       frames, secs, (double) frames / secs);
+
+	unsigned int total = i * slices;
+	if (total) {
+		printf("Beam racing: %u of %u slices late, torn (%.2f%%), by %.3f ms at most, "
+		       "%.3f ms mean slack otherwise\n",
+		       late, total, 100.0 * late / total, late_max / 1e6,
+		       late < total ? slack / (total - late) / 1e6 : 0.0);
+	}
+
+	dump_realtime();
+	dump_thermal();
+	dump_gpu_timers();
+	dump_gpu_stats();
+
+	return ret;
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GLES3/gl3.h>
+
+#include "common.h"
+
+/* Module to cache linked program binaries on disk, so that shaders are
+ * only compiled from source the first time they are run.
+ *
+ * Binaries are looked up by a hash of the shader sources, together with
+ * the GL_RENDERER and GL_VERSION strings, so that a driver update, that
+ * may invalidate the binaries, results in a cache miss.  Drivers may still
+ * reject a binary, in which case the program is rebuilt from source, and
+ * the cache entry replaced.
+ */
+
+#define CACHE_MAGIC "KMSGLSL1"
+
+struct cache_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t length;
+};
+
+static struct {
+	bool enabled;
+	bool es3;
+	char *dir;
+	uint64_t seed;
+
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+} cache;
+
+/* 64-bit FNV-1a */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+	for (; *str; str++) {
+		hash ^= (unsigned char) *str;
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+static int mkdir_p(const char *path)
+{
+	char *dir = strdup(path);
+
+	for (char *p = dir + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(dir, 0755) && errno != EEXIST) {
+			free(dir);
+			return -1;
+		}
+		*p = '/';
+	}
+	free(dir);
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char *default_cache_dir(void)
+{
+	char *dir = NULL;
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if (xdg && *xdg) {
+		asprintf(&dir, "%s/kms-glsl", xdg);
+	} else if (home && *home) {
+		asprintf(&dir, "%s/.cache/kms-glsl", home);
+	}
+
+	return dir;
+}
+
+void init_program_cache(const struct egl *egl, const struct options *options)
+{
+	GLint formats = 0, major = 2;
+
+	if (options->no_program_cache)
+		return;
+
+	/* GL_MAJOR_VERSION is not a valid enum for ES 2.0 contexts: */
+	while (glGetError() != GL_NO_ERROR);
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	cache.es3 = glGetError() == GL_NO_ERROR && major >= 3;
+
+	if (egl->glGetProgramBinaryOES && egl->glProgramBinaryOES) {
+		cache.get_program_binary = egl->glGetProgramBinaryOES;
+		cache.program_binary = egl->glProgramBinaryOES;
+	} else if (cache.es3) {
+		cache.get_program_binary = glGetProgramBinary;
+		cache.program_binary = glProgramBinary;
+	} else {
+		printf("Program binaries are not supported, disabling program cache\n");
+		return;
+	}
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats == 0) {
+		printf("No program binary formats, disabling program cache\n");
+		return;
+	}
+
+	cache.dir = options->cache_dir ? strdup(options->cache_dir) : default_cache_dir();
+	if (!cache.dir || mkdir_p(cache.dir)) {
+		printf("Cannot create program cache directory %s: %s\n",
+		       cache.dir ? cache.dir : "", strerror(errno));
+		return;
+	}
+
+	cache.seed = hash_string(UINT64_C(0xcbf29ce484222325),
+	                         (const char *) glGetString(GL_RENDERER));
+	cache.seed = hash_string(cache.seed, (const char *) glGetString(GL_VERSION));
+
+	cache.enabled = true;
+
+	printf("Using program cache directory: %s\n", cache.dir);
+}
+
+static char *cache_path(const char *vs_src, const char *fs_src)
+{
+	char *path;
+	uint64_t hash = hash_string(hash_string(cache.seed, vs_src), fs_src);
+
+	asprintf(&path, "%s/%016" PRIx64 ".bin", cache.dir, hash);
+
+	return path;
+}
+
+static int load_program_binary(const char *path)
+{
+	struct cache_header header;
+	struct stat statbuf;
+	void *binary;
+	GLuint program;
+	GLint ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &statbuf) < 0 ||
+	    statbuf.st_size < (off_t) sizeof(header) ||
+	    read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.length != statbuf.st_size - sizeof(header)) {
+		close(fd);
+		return -1;
+	}
+
+	binary = malloc(header.length);
+	if (read(fd, binary, header.length) != (ssize_t) header.length) {
+		free(binary);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	program = glCreateProgram();
+	cache.program_binary(program, header.format, binary, header.length);
+	free(binary);
+
+	glGetProgramiv(program, GL_LINK_STATUS, &ret);
+	if (!ret) {
+		printf("Program binary rejected by the driver: %s\n", path);
+		glDeleteProgram(program);
+		return -1;
+	}
+
+	return program;
+}
+
+/* Write the binary to a temporary file, renamed into place, so that
+ * concurrent readers, or a power loss, never observe a partial entry.
+ */
+static void store_program_binary(const char *path, GLuint program)
+{
+	struct cache_header header;
+	GLint length = 0;
+	GLenum format;
+	char *tmp;
+	void *binary;
+	int fd;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	cache.get_program_binary(program, length, &length, &format, binary);
+	if (length <= 0) {
+		free(binary);
+		return;
+	}
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.format = format;
+	header.length = length;
+
+	asprintf(&tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		printf("Cannot create program cache entry %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		free(binary);
+		return;
+	}
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+	    write(fd, binary, length) != length ||
+	    fsync(fd) < 0 ||
+	    close(fd) < 0 ||
+	    rename(tmp, path) < 0) {
+		printf("Cannot write program cache entry %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(binary);
+}
+
+int create_cached_program(const char *vs_src, const char *fs_src, bool *hit)
+{
+	char *path = NULL;
+	int program;
+
+	*hit = false;
+
+	if (cache.enabled) {
+		path = cache_path(vs_src, fs_src);
+		program = load_program_binary(path);
+		if (program >= 0) {
+			*hit = true;
+			free(path);
+			return program;
+		}
+	}
+
+	program = create_program(vs_src, fs_src);
+	if (program < 0) {
+		free(path);
+		return -1;
+	}
+
+	if (cache.enabled && cache.es3)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	if (link_program(program)) {
+		glDeleteProgram(program);
+		free(path);
+		return -1;
+	}
+
+	if (cache.enabled)
+		store_program_binary(path, program);
+
+	free(path);
+
+	return program;
+}
+
+static char *record_path(const char *name, const char *key)
+{
+	char *path;
+	uint64_t hash = hash_string(hash_string(cache.seed, name), key);
+
+	asprintf(&path, "%s/%016" PRIx64 ".%s", cache.dir, hash, name);
+
+	return path;
+}
+
+/* Records are small text values, such as calibration results, stored next
+ * to the binaries and keyed by a name and a source, for the current GPU and
+ * driver.
+ */
+int load_cache_record(const char *name, const char *key, char *value, size_t size)
+{
+	char *path;
+	ssize_t length;
+	int fd;
+
+	if (!cache.enabled)
+		return -1;
+
+	path = record_path(name, key);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+
+	length = read(fd, value, size - 1);
+	close(fd);
+	if (length <= 0)
+		return -1;
+
+	value[length] = '\0';
+	value[strcspn(value, "\n")] = '\0';
+
+	return 0;
+}
+
+void store_cache_record(const char *name, const char *key, const char *value)
+{
+	char *path, *tmp;
+	int fd;
+
+	if (!cache.enabled)
+		return;
+
+	path = record_path(name, key);
+	asprintf(&tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		printf("Cannot create cache record %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		free(path);
+		return;
+	}
+
+	if (dprintf(fd, "%s\n", value) < 0 ||
+	    close(fd) < 0 ||
+	    rename(tmp, path) < 0) {
+		printf("Cannot write cache record %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(path);
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "common.h"
+
+/* Module to render the image pass in checkerboard: the pixels of one parity
+ * of the checkerboard, that alternates each frame, are shaded into a
+ * half-width target, then resolved to the full frame, with the pixels of
+ * the other parity taken from the previous frame, clamped to their shaded
+ * neighbours, not to ghost on motion.
+ */
+
+static struct {
+	struct shading_rate rate;
+	// Resolution of the frame, and width of the half-width targets
+	int width, height;
+	int half_width;
+	unsigned phase;
+	GLuint program;
+	GLint phase_location;
+	GLuint units[2];
+	struct framebuffer fbs[2];
+	// Phase uniform of the image program
+	GLuint image_program;
+	GLint image_phase;
+	int timer;
+} checkerboard;
+
+// Shade the pixels of one parity of the checkerboard, from the half-width
+// target pixels
+static const char *checkerboard_declarations =
+		"uniform float kms_phase;\n"
+		"#define kms_FragCoord vec2(2.0 * floor(gl_FragCoord.x) + "
+		"mod(floor(gl_FragCoord.y) + kms_phase, 2.0) + 0.5, gl_FragCoord.y)\n";
+
+static const char *checkerboard_fs =
+		"#ifdef GL_FRAGMENT_PRECISION_HIGH                            \n"
+		"precision highp float;                                       \n"
+		"#else                                                        \n"
+		"precision mediump float;                                     \n"
+		"#endif                                                       \n"
+		"                                                             \n"
+		"uniform sampler2D current;                                   \n"
+		"uniform sampler2D previous;                                  \n"
+		"uniform vec2 target;                                         \n"
+		"uniform float phase;                                         \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"vec4 fetch(sampler2D half_frame, vec2 p)                     \n"
+		"{                                                            \n"
+		"    vec2 texel = vec2(floor(p.x * 0.5), p.y) + 0.5;          \n"
+		"    return texture2D(half_frame, texel / target);            \n"
+		"}                                                            \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    vec2 p = floor(gl_FragCoord.xy);                         \n"
+		"    vec4 color = fetch(current, p);                          \n"
+		"    if (mod(p.x + p.y + phase, 2.0) >= 1.0) {                \n"
+		"        // Shaded in the previous frame, that is clamped to  \n"
+		"        // the current neighbours, not to ghost on motion    \n"
+		"        vec4 l = fetch(current, p - vec2(1.0, 0.0));         \n"
+		"        vec4 r = fetch(current, p + vec2(1.0, 0.0));         \n"
+		"        vec4 d = fetch(current, p - vec2(0.0, 1.0));         \n"
+		"        vec4 u = fetch(current, p + vec2(0.0, 1.0));         \n"
+		"        vec4 lo = min(min(l, r), min(d, u));                 \n"
+		"        vec4 hi = max(max(l, r), max(d, u));                 \n"
+		"        color = clamp(fetch(previous, p), lo, hi);           \n"
+		"    }                                                        \n"
+		"    gl_FragColor = color;                                    \n"
+		"}                                                            \n";
+
+static void begin_checkerboard(GLuint program, unsigned frame, const GLfloat mouse[4])
+{
+	(void) mouse;
+
+	if (checkerboard.image_program != program) {
+		checkerboard.image_program = program;
+		checkerboard.image_phase = glGetUniformLocation(program, "kms_phase");
+	}
+
+	checkerboard.phase = frame % 2;
+}
+
+static bool draw_checkerboard(GLuint program, unsigned i)
+{
+	if (i > 0)
+		return false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, checkerboard.fbs[checkerboard.phase].fb);
+	glViewport(0, 0, checkerboard.half_width, checkerboard.height);
+	glUseProgram(program);
+	glUniform1f(checkerboard.image_phase, checkerboard.phase);
+
+	return true;
+}
+
+static void resolve_checkerboard(GLuint target)
+{
+	unsigned phase = checkerboard.phase;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, checkerboard.width, checkerboard.height);
+	glUseProgram(checkerboard.program);
+	glUniform1f(checkerboard.phase_location, phase);
+	glActiveTexture(GL_TEXTURE0 + checkerboard.units[0]);
+	glBindTexture(GL_TEXTURE_2D, checkerboard.fbs[phase].tex);
+	glActiveTexture(GL_TEXTURE0 + checkerboard.units[1]);
+	glBindTexture(GL_TEXTURE_2D, checkerboard.fbs[!phase].tex);
+	glActiveTexture(GL_TEXTURE0);
+
+	begin_gpu_timer(checkerboard.timer);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	end_gpu_timer(checkerboard.timer);
+}
+
+/* Sets up the checkerboard rendering of a width x height image pass */
+const struct shading_rate *init_checkerboard(int width, int height)
+{
+	int ret;
+
+	ret = create_quad_program(checkerboard_fs);
+	if (ret < 0)
+		return NULL;
+	checkerboard.program = ret;
+
+	checkerboard.width = width;
+	checkerboard.height = height;
+	checkerboard.half_width = (width + 1) / 2;
+	for (int i = 0; i < 2; i++) {
+		if (!create_offscreen_framebuffer(&checkerboard.fbs[i], checkerboard.half_width, height,
+		                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE))
+			return NULL;
+	}
+
+	checkerboard.units[0] = reserve_texture_unit();
+	checkerboard.units[1] = reserve_texture_unit();
+
+	glUseProgram(checkerboard.program);
+	glUniform1i(glGetUniformLocation(checkerboard.program, "current"), checkerboard.units[0]);
+	glUniform1i(glGetUniformLocation(checkerboard.program, "previous"), checkerboard.units[1]);
+	glUniform2f(glGetUniformLocation(checkerboard.program, "target"), checkerboard.half_width, height);
+	checkerboard.phase_location = glGetUniformLocation(checkerboard.program, "phase");
+
+	checkerboard.timer = create_gpu_timer("checkerboard resolve");
+
+	checkerboard.rate = (struct shading_rate) {
+			.declarations = checkerboard_declarations,
+			.temporal = true,
+			.begin = begin_checkerboard,
+			.draw = draw_checkerboard,
+			.resolve = resolve_checkerboard,
+	};
+
+	return &checkerboard.rate;
+}
@@ -136,7 +136,10 @@ static struct gbm_bo *init_gbm_bo(const uint64_t *modifiers,
 static int init_gbm_buffer_objects(const uint64_t *modifiers,
                                    const unsigned int count)
 {
-	for (unsigned i = 0; i < ARRAY_SIZE(gbm.bos); i++) {
+	/* Beam racing renders into the scanned out buffer */
+	unsigned buffers = gbm.drm->beam_slices ? 1 : ARRAY_SIZE(gbm.bos);
+
+	for (unsigned i = 0; i < buffers; i++) {
 		gbm.bos[i] = init_gbm_bo(modifiers, count);
 		if (!gbm.bos[i])
 			return -1;
@@ -144,7 +147,7 @@ static int init_gbm_buffer_objects(const uint64_t *modifiers,
 	return 0;
 }
 
-static bool has_ext(const char *extension_list, const char *ext)
+bool has_ext(const char *extension_list, const char *ext)
 {
 	const char *ptr = extension_list;
 	size_t len = strlen(ext);
@@ -304,6 +307,40 @@ static bool create_framebuffer(const struct egl *egl, struct gbm_bo *bo,
 	return true;
 }
 
+/* Create a texture backed framebuffer, to render intermediate results to */
+bool create_offscreen_framebuffer(struct framebuffer *fb, int width, int height,
+                                  GLint internal_format, GLenum format, GLenum type)
+{
+	fb->image = EGL_NO_IMAGE_KHR;
+
+	glGenTextures(1, &fb->tex);
+	glBindTexture(GL_TEXTURE_2D, fb->tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+	             format, type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fb->fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb->fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+			fb->tex, 0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("failed framebuffer check for offscreen buffer: 0x%x\n", status);
+		glDeleteFramebuffers(1, &fb->fb);
+		glDeleteTextures(1, &fb->tex);
+		return false;
+	}
+
+	return true;
+}
+
 int init_egl_modifiers(struct egl *egl, const struct drm *drm,
                        unsigned int format)
 {
@@ -449,9 +486,12 @@ const struct egl * init_egl(const struct gbm *gbm, uint64_t modifier, bool surfa
 	get_proc_dpy(EGL_KHR_fence_sync, eglWaitSyncKHR);
 	get_proc_dpy(EGL_KHR_fence_sync, eglClientWaitSyncKHR);
 	get_proc_dpy(EGL_ANDROID_native_fence_sync, eglDupNativeFenceFDANDROID);
+	get_proc_dpy(EGL_KHR_partial_update, eglSetDamageRegionKHR);
 
 	egl.modifiers_supported = has_ext(egl_exts_dpy,
 					"EGL_EXT_image_dma_buf_import_modifiers");
+	egl.buffer_age_supported = has_ext(egl_exts_dpy, "EGL_EXT_buffer_age") ||
+	                           has_ext(egl_exts_dpy, "EGL_KHR_partial_update");
 
 	printf("Using display %p with EGL version %d.%d\n",
 			egl.display, major, minor);
@@ -530,6 +570,17 @@ const struct egl * init_egl(const struct gbm *gbm, uint64_t modifier, bool surfa
 
 	get_proc_gl(GL_OES_EGL_image, glEGLImageTargetTexture2DOES);
 
+	get_proc_gl(GL_OES_get_program_binary, glGetProgramBinaryOES);
+	get_proc_gl(GL_OES_get_program_binary, glProgramBinaryOES);
+
+	get_proc_gl(GL_KHR_parallel_shader_compile, glMaxShaderCompilerThreadsKHR);
+
+	get_proc_gl(GL_EXT_disjoint_timer_query, glGenQueriesEXT);
+	get_proc_gl(GL_EXT_disjoint_timer_query, glBeginQueryEXT);
+	get_proc_gl(GL_EXT_disjoint_timer_query, glEndQueryEXT);
+	get_proc_gl(GL_EXT_disjoint_timer_query, glGetQueryObjectuivEXT);
+	get_proc_gl(GL_EXT_disjoint_timer_query, glGetQueryObjectui64vEXT);
+
 	get_proc_gl(GL_AMD_performance_monitor, glGetPerfMonitorGroupsAMD);
 	get_proc_gl(GL_AMD_performance_monitor, glGetPerfMonitorCountersAMD);
 	get_proc_gl(GL_AMD_performance_monitor, glGetPerfMonitorGroupStringAMD);
@@ -542,8 +593,18 @@ const struct egl * init_egl(const struct gbm *gbm, uint64_t modifier, bool surfa
 	get_proc_gl(GL_AMD_performance_monitor, glEndPerfMonitorAMD);
 	get_proc_gl(GL_AMD_performance_monitor, glGetPerfMonitorCounterDataAMD);
 
+	get_proc_gl(GL_INTEL_performance_query, glGetFirstPerfQueryIdINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glGetNextPerfQueryIdINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glGetPerfQueryInfoINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glGetPerfCounterInfoINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glCreatePerfQueryINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glDeletePerfQueryINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glBeginPerfQueryINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glEndPerfQueryINTEL);
+	get_proc_gl(GL_INTEL_performance_query, glGetPerfQueryDataINTEL);
+
 	if (!gbm->surface) {
-		for (unsigned i = 0; i < ARRAY_SIZE(gbm->bos); i++) {
+		for (unsigned i = 0; i < ARRAY_SIZE(gbm->bos) && gbm->bos[i]; i++) {
 			if (!create_framebuffer(&egl, gbm->bos[i], &egl.fbs[i])) {
 				printf("Failed to create framebuffer\n");
 				return NULL;
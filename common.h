@@ -103,6 +103,26 @@ EGLAPI EGLBoolean EGLAPIENTRY eglQueryDmaBufModifiersEXT (EGLDisplay dpy, EGLint
 
 #define NUM_BUFFERS 2
 
+/* Shadertoy Buffer A-D passes, and iChannel0-3 inputs */
+#define MAX_PASS_BUFFERS 4
+#define NUM_CHANNELS 4
+
+#define MAX_DEFINES 16
+
+/* Float precision of the image pass fragment shader */
+enum precision {
+	PRECISION_HIGHP,
+	PRECISION_MEDIUMP,
+	PRECISION_AUTO,
+};
+
+/* Scheduling policy of the render thread */
+enum scheduling {
+	SCHEDULING_DEFAULT,
+	SCHEDULING_FIFO,
+	SCHEDULING_DEADLINE,
+};
+
 struct options {
 	const char *device;
 	char mode[DRM_DISPLAY_MODE_LEN];
@@ -115,6 +135,35 @@ struct options {
 	bool show_hud;
 	unsigned int vrefresh;
 	unsigned int frames;
+	const char *cache_dir;
+	bool no_program_cache;
+	bool watch;
+	const char *playlist;
+	float crossfade;
+	const char *buffers[MAX_PASS_BUFFERS];
+	char channels[NUM_CHANNELS];
+	bool specialize;
+	const char *defines[MAX_DEFINES];
+	enum precision precision;
+	float target_fps;
+	bool compute;
+	bool checkerboard;
+	float taau;
+	float upscale;
+	float render_rate;
+	bool interpolate;
+	const char *foveate;
+	bool skip_static;
+	float max_fps;
+	unsigned vblank_divisor;
+	bool vrr;
+	bool adaptive_mode;
+	bool mailbox;
+	unsigned beam_slices;
+	enum scheduling scheduling;
+	const char *cpu_affinity;
+	float thermal_limit;
+	const char *sysfs_root;
 };
 
 struct gbm {
@@ -151,6 +200,21 @@ struct egl {
 	PFNEGLWAITSYNCKHRPROC eglWaitSyncKHR;
 	PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
 	PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
+	PFNEGLSETDAMAGEREGIONKHRPROC eglSetDamageRegionKHR;
+
+	/* OES_get_program_binary */
+	PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+	PFNGLPROGRAMBINARYOESPROC    glProgramBinaryOES;
+
+	/* KHR_parallel_shader_compile */
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+
+	/* EXT_disjoint_timer_query */
+	PFNGLGENQUERIESEXTPROC            glGenQueriesEXT;
+	PFNGLBEGINQUERYEXTPROC            glBeginQueryEXT;
+	PFNGLENDQUERYEXTPROC              glEndQueryEXT;
+	PFNGLGETQUERYOBJECTUIVEXTPROC     glGetQueryObjectuivEXT;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC   glGetQueryObjectui64vEXT;
 
 	/* AMD_performance_monitor */
 	PFNGLGETPERFMONITORGROUPSAMDPROC         glGetPerfMonitorGroupsAMD;
@@ -165,12 +229,35 @@ struct egl {
 	PFNGLENDPERFMONITORAMDPROC               glEndPerfMonitorAMD;
 	PFNGLGETPERFMONITORCOUNTERDATAAMDPROC    glGetPerfMonitorCounterDataAMD;
 
+	/* INTEL_performance_query */
+	PFNGLGETFIRSTPERFQUERYIDINTELPROC        glGetFirstPerfQueryIdINTEL;
+	PFNGLGETNEXTPERFQUERYIDINTELPROC         glGetNextPerfQueryIdINTEL;
+	PFNGLGETPERFQUERYINFOINTELPROC           glGetPerfQueryInfoINTEL;
+	PFNGLGETPERFCOUNTERINFOINTELPROC         glGetPerfCounterInfoINTEL;
+	PFNGLCREATEPERFQUERYINTELPROC            glCreatePerfQueryINTEL;
+	PFNGLDELETEPERFQUERYINTELPROC            glDeletePerfQueryINTEL;
+	PFNGLBEGINPERFQUERYINTELPROC             glBeginPerfQueryINTEL;
+	PFNGLENDPERFQUERYINTELPROC               glEndPerfQueryINTEL;
+	PFNGLGETPERFQUERYDATAINTELPROC           glGetPerfQueryDataINTEL;
+
 	bool modifiers_supported;
+	bool buffer_age_supported;
 
 	EGLuint64KHR *modifiers;
 	EGLint num_modifiers;
 
 	void (*draw)(uint64_t start_time, unsigned frame, float fps);
+	/* Optional, to present a frame between renders */
+	void (*present)(float progress, float fps);
+	/* Optional, the region of the next frame that changes, as x, y, width
+	 * and height from the bottom left, or false when the frame does not
+	 * change and does not need to be presented again.
+	 */
+	bool (*damage)(int rect[4]);
+	/* Renders the rows from y to y + height of the frame, from the bottom
+	 * left, the inputs being updated with the slice at y = 0.
+	 */
+	void (*draw_slice)(uint64_t start_time, unsigned frame, float fps, int y, int height);
 };
 
 static inline int __egl_check(void *ptr, const char *name)
@@ -185,13 +272,118 @@ static inline int __egl_check(void *ptr, const char *name)
 #define egl_check(egl, name) __egl_check((egl)->name, #name)
 
 const struct egl * init_egl(const struct gbm *gbm, uint64_t modifier, bool surfaceless);
+bool has_ext(const char *extension_list, const char *ext);
+bool create_offscreen_framebuffer(struct framebuffer *fb, int width, int height,
+                                  GLint internal_format, GLenum format, GLenum type);
 
 int create_program(const char *vs_src, const char *fs_src);
 int link_program(unsigned program);
 
+void init_program_cache(const struct egl *egl, const struct options *options);
+int create_cached_program(const char *vs_src, const char *fs_src, bool *hit);
+int load_cache_record(const char *name, const char *key, char *value, size_t size);
+void store_cache_record(const char *name, const char *key, const char *value);
+
+enum compile_status {
+	COMPILE_PENDING,
+	COMPILE_DONE,
+	COMPILE_FAILED,
+};
+
+struct compile_job;
+
+int init_compiler(const struct egl *egl);
+struct compile_job *compile_async(char *vs_src, char *fs_src);
+enum compile_status compile_job_status(struct compile_job *job);
+int compile_job_take_program(struct compile_job *job, bool *cache_hit, uint64_t *build_time_ns);
+void free_compile_job(struct compile_job *job);
+
+int watch_file(const char *path, void (*callback)(const char *path, void *data), void *data);
+
+int init_event_loop(void);
+int add_event_source(int fd, void (*callback)(int fd, void *data), void *data);
+void remove_event_source(int fd);
+int dispatch_events(int timeout);
+int wait_events_until(uint64_t time);
+int wait_fence(int fd);
+int finish_render(const struct egl *egl);
+bool event_loop_interrupted(void);
+
 int init_shadertoy(const struct gbm *gbm, struct egl *egl, const char *shadertoy, const struct options *options);
+struct compile_job *compile_shadertoy(const char *file);
+int benchmark_specialization(const char *file, unsigned frames);
+int precompile_shadertoys(const char *dir, const struct options *options);
+GLuint reserve_texture_unit(void);
+int create_quad_program(const char *fs_src);
+
+/* Reduced shading rate modes of the image pass, that render it into their
+ * own targets, at lower resolutions, then resolve them to the frame.
+ */
+struct shading_rate {
+	/* Declarations of the image pass, defining kms_FragCoord */
+	const char *declarations;
+	/* Whether the resolved frame depends on the previous ones */
+	bool temporal;
+	/* Called once per frame, with the image program */
+	void (*begin)(GLuint program, unsigned frame, const GLfloat mouse[4]);
+	/* Binds the target of the i-th draw of the image pass, and sets its
+	 * uniforms, or returns false past the last one.
+	 */
+	bool (*draw)(GLuint program, unsigned i);
+	/* Resolves the draws to the target framebuffer */
+	void (*resolve)(GLuint target);
+};
 
-void init_perfcntrs(const struct egl *egl, const char *perfcntrs);
+const struct shading_rate *init_checkerboard(int width, int height);
+const struct shading_rate *init_taau(int width, int height, float scale, bool half_float);
+const struct shading_rate *init_upscale(int width, int height, float scale);
+const struct shading_rate *init_foveation(int width, int height, const char *layout);
+
+const char *init_playlist(const char *file);
+void start_playlist(void);
+bool update_playlist(uint64_t time, GLuint *program, const char **file);
+void dump_playlist(void);
+
+struct compile_job *compile_shadertoy_variant(const char *shader, const char *const *defines);
+int init_quality(const char *shader, float target_fps);
+const char *const *quality_defines(unsigned level);
+void start_quality(const char *shader, GLuint program);
+bool update_quality(uint64_t time, GLuint *program);
+void dump_quality(void);
+
+void init_gpu_timers(const struct egl *egl);
+int create_gpu_timer(const char *name);
+void begin_gpu_timer(int id);
+void end_gpu_timer(int id);
+void dump_gpu_timers(void);
+
+void init_pacing(float rate, float refresh);
+void pacing_refresh_changed(float refresh);
+bool start_pacing_frame(uint64_t time);
+float pacing_progress(void);
+void end_pacing_frame(uint64_t time);
+void init_frame_cap(float max_fps);
+void wait_frame_cap(void);
+void record_presentation(uint64_t time);
+void dump_pacing(void);
+
+int init_realtime(const struct options *options, float refresh);
+void start_realtime(void);
+void record_wakeup(uint64_t intended, uint64_t actual);
+void dump_realtime(void);
+
+int init_thermal(const struct options *options, float refresh, float max_fps);
+void thermal_refresh_changed(float refresh);
+bool thermal_frame_cap(float *max_fps);
+void thermal_quality_levels(unsigned count);
+bool thermal_quality_ceiling(unsigned *level);
+void dump_thermal(void);
+
+void init_gpu_stats(int fd);
+void sample_gpu_stats(uint64_t time);
+void dump_gpu_stats(void);
+
+void init_perfcntrs(const struct egl *egl, const struct gbm *gbm, const char *perfcntrs);
 void start_perfcntrs(void);
 void end_perfcntrs(void);
 void finish_perfcntrs(void);
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/* Module to build programs in the background, on a worker thread, with an
+ * EGL context that shares its objects with the rendering context, so that
+ * the render loop never stalls on shader compilation.
+ *
+ * Jobs are processed in submission order.  The render thread polls the
+ * status of the jobs it submitted, and takes ownership of the program once
+ * the job is done.  A job can be freed at any time: if it's still pending,
+ * it's cancelled and the resulting program, if any, is discarded.
+ */
+
+struct compile_job {
+	char *vs_src;
+	char *fs_src;
+
+	enum compile_status status;
+	bool cancelled;
+	bool cache_hit;
+	int program;
+	uint64_t build_time_ns;
+
+	struct compile_job *next;
+};
+
+static struct {
+	const struct egl *egl;
+	EGLContext context;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct compile_job *head, *tail;
+} compiler = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void free_job(struct compile_job *job)
+{
+	if (job->program > 0)
+		glDeleteProgram(job->program);
+	free(job->vs_src);
+	free(job->fs_src);
+	free(job);
+}
+
+static void *compiler_thread(void *arg)
+{
+	(void) arg;
+
+	if (!eglMakeCurrent(compiler.egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+	                    compiler.context)) {
+		printf("Failed to make the compiler context current\n");
+		return NULL;
+	}
+
+	/* Let the driver use as many threads as it sees fit, to compile the
+	 * queued programs:
+	 */
+	if (compiler.egl->glMaxShaderCompilerThreadsKHR)
+		compiler.egl->glMaxShaderCompilerThreadsKHR(0xffffffff);
+
+	pthread_mutex_lock(&compiler.lock);
+	for (;;) {
+		while (!compiler.head)
+			pthread_cond_wait(&compiler.cond, &compiler.lock);
+
+		struct compile_job *job = compiler.head;
+		compiler.head = job->next;
+		if (!compiler.head)
+			compiler.tail = NULL;
+
+		if (job->cancelled) {
+			free_job(job);
+			continue;
+		}
+
+		pthread_mutex_unlock(&compiler.lock);
+
+		uint64_t start_time = get_time_ns();
+		int program = create_cached_program(job->vs_src, job->fs_src, &job->cache_hit);
+
+		/* Make sure the program is complete, before it's used from the
+		 * rendering context:
+		 */
+		glFinish();
+
+		pthread_mutex_lock(&compiler.lock);
+
+		job->program = program;
+		job->build_time_ns = get_time_ns() - start_time;
+		job->status = program < 0 ? COMPILE_FAILED : COMPILE_DONE;
+
+		if (job->cancelled)
+			free_job(job);
+	}
+
+	return NULL;
+}
+
+int init_compiler(const struct egl *egl)
+{
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+
+	if (compiler.egl)
+		return 0;
+
+	if (!has_ext(eglQueryString(egl->display, EGL_EXTENSIONS),
+	             "EGL_KHR_surfaceless_context")) {
+		printf("No EGL_KHR_surfaceless_context, cannot compile in the background\n");
+		return -1;
+	}
+
+	compiler.context = eglCreateContext(egl->display, egl->config,
+	                                    egl->context, context_attribs);
+	if (compiler.context == EGL_NO_CONTEXT) {
+		printf("Failed to create shared EGL context\n");
+		return -1;
+	}
+
+	compiler.egl = egl;
+
+	if (pthread_create(&compiler.thread, NULL, compiler_thread, NULL)) {
+		printf("Failed to start compiler thread\n");
+		eglDestroyContext(egl->display, compiler.context);
+		compiler.egl = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct compile_job *compile_async(char *vs_src, char *fs_src)
+{
+	struct compile_job *job = calloc(1, sizeof(*job));
+
+	job->vs_src = vs_src;
+	job->fs_src = fs_src;
+	job->status = COMPILE_PENDING;
+
+	pthread_mutex_lock(&compiler.lock);
+	if (compiler.tail)
+		compiler.tail->next = job;
+	else
+		compiler.head = job;
+	compiler.tail = job;
+	pthread_cond_signal(&compiler.cond);
+	pthread_mutex_unlock(&compiler.lock);
+
+	return job;
+}
+
+enum compile_status compile_job_status(struct compile_job *job)
+{
+	enum compile_status status;
+
+	pthread_mutex_lock(&compiler.lock);
+	status = job->status;
+	pthread_mutex_unlock(&compiler.lock);
+
+	return status;
+}
+
+int compile_job_take_program(struct compile_job *job, bool *cache_hit, uint64_t *build_time_ns)
+{
+	int program;
+
+	pthread_mutex_lock(&compiler.lock);
+	program = job->status == COMPILE_DONE ? job->program : -1;
+	job->program = 0;
+	if (cache_hit)
+		*cache_hit = job->cache_hit;
+	if (build_time_ns)
+		*build_time_ns = job->build_time_ns;
+	pthread_mutex_unlock(&compiler.lock);
+
+	return program;
+}
+
+void free_compile_job(struct compile_job *job)
+{
+	pthread_mutex_lock(&compiler.lock);
+	if (job->status == COMPILE_PENDING) {
+		/* cancelled, and freed by the compiler thread */
+		job->cancelled = true;
+	} else {
+		free_job(job);
+	}
+	pthread_mutex_unlock(&compiler.lock);
+}
@@ -24,16 +24,17 @@
  */
 
 #include <errno.h>
-#include <poll.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "common.h"
 #include "drm-common.h"
 
 static struct drm drm;
 
+/* Whether a page flip event is pending, cleared by the event loop */
+static bool waiting_for_flip;
+
 static int add_connector_property(drmModeAtomicReq *req, uint32_t obj_id,
                                   const char *name, uint64_t value)
 {
@@ -92,11 +93,15 @@ static int add_plane_property(drmModeAtomicReq *req, uint32_t obj_id,
 	return drmModeAtomicAddProperty(req, obj_id, prop_info->prop_id, value);
 }
 
-static int drm_atomic_commit(uint32_t fb_id, uint32_t flags)
+/* Whether the plane supports damage clips, unknown until the first damage */
+static int damage_clips = -1;
+
+static int drm_atomic_commit(uint32_t fb_id, uint32_t flags, const int *damage)
 {
 	drmModeAtomicReq *req;
 	uint32_t plane_id = drm.plane->plane->plane_id;
-	uint32_t blob_id;
+	uint32_t blob_id, damage_id = 0;
+	unsigned int prop_idx;
 	int ret;
 
 	req = drmModeAtomicAlloc();
@@ -115,6 +120,9 @@ static int drm_atomic_commit(uint32_t fb_id, uint32_t flags)
 
 		if (add_crtc_property(req, drm.crtc_id, "ACTIVE", 1) < 0)
 			return -1;
+
+		if (drm.vrr && add_crtc_property(req, drm.crtc_id, "VRR_ENABLED", 1) < 0)
+			return -1;
 	}
 
 	add_plane_property(req, plane_id, "FB_ID", fb_id);
@@ -128,10 +136,31 @@ static int drm_atomic_commit(uint32_t fb_id, uint32_t flags)
 	add_plane_property(req, plane_id, "CRTC_W", drm.mode->hdisplay);
 	add_plane_property(req, plane_id, "CRTC_H", drm.mode->vdisplay);
 
+	/* Partial damage, in the framebuffer coordinates */
+	if (damage && (damage[2] < drm.mode->hdisplay || damage[3] < drm.mode->vdisplay)) {
+		if (damage_clips < 0)
+			damage_clips = !find_plane_prop(&drm, "FB_DAMAGE_CLIPS", &prop_idx);
+
+		struct drm_mode_rect clip = {
+				.x1 = damage[0],
+				.y1 = damage[1],
+				.x2 = damage[0] + damage[2],
+				.y2 = damage[1] + damage[3],
+		};
+		if (damage_clips &&
+		    drmModeCreatePropertyBlob(drm.fd, &clip, sizeof(clip), &damage_id) == 0)
+			add_plane_property(req, plane_id, "FB_DAMAGE_CLIPS", damage_id);
+	}
+
 	ret = drmModeAtomicCommit(drm.fd, req, flags, NULL);
+	if (ret == 0 && (flags & DRM_MODE_PAGE_FLIP_EVENT))
+		waiting_for_flip = true;
 
 	drmModeAtomicFree(req);
 
+	if (damage_id)
+		drmModeDestroyPropertyBlob(drm.fd, damage_id);
+
 	return ret;
 }
 
@@ -139,18 +168,118 @@ static void page_flip_handler(int fd, unsigned int frame,
                               unsigned int sec, unsigned int usec, void *data)
 {
 	/* suppress 'unused parameter' warnings */
-	(void) fd, (void) frame, (void) sec, (void) usec, (void) data;
+	(void) fd, (void) data;
 	//	printf("page flip event occurred: %12.6f\n", sec + (usec / 1000000.0));
+
+	drm.flip_sequence = frame;
+	drm.flip_time = sec * NSEC_PER_SEC + usec * (NSEC_PER_SEC / USEC_PER_SEC);
+	waiting_for_flip = false;
+}
+
+static void handle_drm_events(int fd, void *data)
+{
+	if (drmHandleEvent(fd, data))
+		printf("failed to handle DRM events: %s\n", strerror(errno));
+}
+
+/* Dispatches the events until the pending page flip completes, or until the
+ * user interrupts.
+ */
+static int wait_flip(void)
+{
+	while (waiting_for_flip && !event_loop_interrupted()) {
+		if (dispatch_events(-1))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Low framerate compensation: while the frame being rendered is not ready
+ * within the longest refresh interval of the panel, the last one is presented
+ * again, for the refresh rate to stay within the VRR range.
+ */
+static int wait_render_lfc(const struct egl *egl, uint32_t fb_id, uint32_t flags,
+                           unsigned *repeats)
+{
+	uint64_t max_interval = NSEC_PER_SEC / drm.vrr_min;
+	EGLSyncKHR fence;
+	EGLint status;
+	int ret = 0;
+
+	fence = egl->eglCreateSyncKHR(egl->display, EGL_SYNC_FENCE_KHR, NULL);
+	if (fence == EGL_NO_SYNC_KHR) {
+		glFinish();
+		return 0;
+	}
+
+	for (;;) {
+		uint64_t elapsed = get_time_ns() - drm.flip_time;
+
+		status = egl->eglClientWaitSyncKHR(egl->display, fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+		                                   elapsed < max_interval ? max_interval - elapsed : 0);
+		if (status != EGL_TIMEOUT_EXPIRED_KHR)
+			break;
+
+		ret = drm_atomic_commit(fb_id, flags, NULL);
+		if (ret)
+			break;
+		ret = wait_flip();
+		if (ret || event_loop_interrupted())
+			break;
+		(*repeats)++;
+	}
+
+	egl->eglDestroySyncKHR(egl->display, fence);
+
+	return ret;
+}
+
+/* Completes the pending flip, if any, without waiting for it, then flips to
+ * the newest completed frame, bo, or the one queued during the last render.
+ */
+static int present_mailbox(struct mailbox *mailbox, struct gbm_bo *bo, uint32_t flags)
+{
+	struct gbm_bo *flip;
+	struct drm_fb *fb;
+
+	if (dispatch_events(0))
+		return -1;
+	if (mailbox->pending && !waiting_for_flip)
+		mailbox_flipped(mailbox, drm.flip_time);
+
+	flip = mailbox_next(mailbox, bo);
+	if (!flip)
+		return 0;
+
+	fb = drm_fb_get_from_bo(flip);
+	if (!fb)
+		return -1;
+
+	return drm_atomic_commit(fb->fb_id, flags, NULL);
 }
 
+/* Time the render rate is measured for, before adapting the mode to it */
+#define WARMUP_NS (3 * NSEC_PER_SEC)
+
 static int atomic_run(const struct gbm *gbm, const struct egl *egl)
 {
 	struct gbm_bo *bo = NULL;
-	struct drm_fb *fb;
-	uint32_t i = 0;
+	struct drm_fb *fb = NULL;
+	uint32_t i = 0, rendered = 0, drawn = 0, skipped = 0, repeats = 0;
 	uint64_t start_time, report_time, cur_time;
 	int ret;
 
+	/* time spent rendering during the warm-up, for adaptive mode switching */
+	bool warmup = drm.count_modes > 1;
+	uint64_t render_start = 0, warmup_time = 0;
+	unsigned warmup_renders = 0;
+
+	/* frames presented at vblank, in place of the queued ones */
+	struct mailbox mailbox = {
+			.surface = gbm->surface,
+	};
+
 	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
 	if (drm.async_page_flip) {
 		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
@@ -160,16 +289,24 @@ static int atomic_run(const struct gbm *gbm, const struct egl *egl)
 
 	drmEventContext evctx = {
 			.version = 4,
-			.page_flip_handler = page_flip_handler
+			.page_flip_handler = page_flip_handler,
+			.vblank_handler = vblank_handler,
+			.sequence_handler = sequence_handler,
 	};
 
 	/* Allow a modeset change for the first commit only. */
 	flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 
+	if (add_event_source(drm.fd, handle_drm_events, &evctx)) {
+		printf("failed to watch DRM events: %s\n", strerror(errno));
+		return -1;
+	}
+
+	start_realtime();
+
 	start_time = report_time = get_time_ns();
 
 	while (drm.frames == 0 || i < drm.frames) {
-		unsigned frame = i;
 		struct gbm_bo *next_bo;
 
 		/* Start fps measuring on second frame, to remove the time spent
@@ -179,8 +316,36 @@ static int atomic_run(const struct gbm *gbm, const struct egl *egl)
 			start_time = report_time = get_time_ns();
 		}
 
+		wait_frame_cap();
+
+		if (drm.mailbox && present_mailbox(&mailbox, NULL, flags)) {
+			printf("failed to present the queued frame: %s\n", strerror(errno));
+			return -1;
+		}
+		if (mailbox.pending)
+			flags &= ~(DRM_MODE_ATOMIC_ALLOW_MODESET);
+
+		/* Frames that do not change are not presented again, until
+		 * they do.
+		 */
+		int damage[4];
+		bool idle = egl->damage && !egl->damage(damage);
+
+		/* The GL origin of the window surface is at the bottom, while
+		 * the rows of the surfaceless framebuffers are the scanout
+		 * lines, from the top.
+		 */
+		if (!idle && egl->damage && gbm->surface)
+			damage[1] = drm.mode->vdisplay - (damage[1] + damage[3]);
+
+		/* Vblanks between renders present the last one again, unless
+		 * the renderer presents frames in between.
+		 */
+		bool render = !idle && start_pacing_frame(get_time_ns());
+		bool draw = render || (!idle && egl->present);
+
 		if (!gbm->surface) {
-			glBindFramebuffer(GL_FRAMEBUFFER, egl->fbs[frame % NUM_BUFFERS].fb);
+			glBindFramebuffer(GL_FRAMEBUFFER, egl->fbs[drawn % NUM_BUFFERS].fb);
 		}
 
 		// Calculate current FPS
@@ -192,81 +357,154 @@ static int atomic_run(const struct gbm *gbm, const struct egl *egl)
 			}
 		}
 
-		egl->draw(start_time, i++, fps);
-
-		/* Block until all the buffered GL operations are completed.
-		 * This is required on NVIDIA GPUs, for which the DRM drivers
-		 * do not wait for the rendering to complete, upon executing
-		 * page flipping operations.
-		 */
-		glFinish();
-
-		if (gbm->surface) {
-			eglSwapBuffers(egl->display, egl->surface);
+		if (render) {
+			render_start = get_time_ns();
+			egl->draw(start_time, rendered++, fps);
+		} else if (draw) {
+			egl->present(pacing_progress(), fps);
 		}
+		/* Only the presented frames count, not the idle refresh intervals */
+		if (!idle)
+			i++;
+
+		if (draw) {
+			/* Block until all the buffered GL operations are completed.
+			 * This is required on NVIDIA GPUs, for which the DRM drivers
+			 * do not wait for the rendering to complete, upon executing
+			 * page flipping operations.
+			 */
+			if (drm.vrr && fb && egl->eglCreateSyncKHR) {
+				if (wait_render_lfc(egl, fb->fb_id, flags, &repeats)) {
+					printf("failed to present the last frame again: %s\n", strerror(errno));
+					return -1;
+				}
+			} else if (finish_render(egl)) {
+				return -1;
+			}
+			end_pacing_frame(get_time_ns());
+
+			/* The render rate, without the waits for vblanks, is measured
+			 * past the first frame, then the mode is switched once, with
+			 * the next commit.
+			 */
+			if (warmup && render && i > 1) {
+				cur_time = get_time_ns();
+				warmup_time += cur_time - render_start;
+				warmup_renders++;
+				if (cur_time - start_time > WARMUP_NS) {
+					if (select_refresh_rate(&drm, warmup_renders * (double) NSEC_PER_SEC / warmup_time))
+						flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+					warmup = false;
+				}
+			}
+
+			if (gbm->surface) {
+				eglSwapBuffers(egl->display, egl->surface);
+			}
 
-		if (gbm->surface) {
-			next_bo = gbm_surface_lock_front_buffer(gbm->surface);
+			if (gbm->surface) {
+				next_bo = gbm_surface_lock_front_buffer(gbm->surface);
+			} else {
+				next_bo = gbm->bos[drawn % NUM_BUFFERS];
+			}
+			if (!next_bo) {
+				printf("Failed to lock front buffer\n");
+				return -1;
+			}
+			fb = drm_fb_get_from_bo(next_bo);
+			if (!fb) {
+				printf("Failed to get a new framebuffer BO\n");
+				return -1;
+			}
+			drawn++;
 		} else {
-			next_bo = gbm->bos[frame % NUM_BUFFERS];
-		}
-		if (!next_bo) {
-			printf("Failed to lock front buffer\n");
-			return -1;
-		}
-		fb = drm_fb_get_from_bo(next_bo);
-		if (!fb) {
-			printf("Failed to get a new framebuffer BO\n");
-			return -1;
+			next_bo = bo;
 		}
 
 		cur_time = get_time_ns();
+		sample_gpu_stats(cur_time);
 		if (cur_time > (report_time + 2 * NSEC_PER_SEC)) {
 			double elapsed_time = cur_time - start_time;
 			double secs = elapsed_time / (double) NSEC_PER_SEC;
 			unsigned frames = i - 1;  /* first frame ignored */
 			printf("Rendered %u frames in %f sec (%f fps)\n",
 			       frames, secs, (double) frames / secs);
+			if (skipped)
+				printf("Skipped %u unchanged frames\n", skipped);
 			report_time = cur_time;
 		}
 
-		/* Check for user input: */
-		struct pollfd fdset[] = {
-				{
-						.fd = STDIN_FILENO,
-						.events = POLLIN,
-				}
-		};
-		ret = poll(fdset, ARRAY_SIZE(fdset), 0);
-		if (ret > 0) {
-			printf("user interrupted!\n");
+		/* Idle for a refresh interval, instead of the page flip, else
+		 * check for user input, when not waiting for the flip below.
+		 */
+		if (idle) {
+			ret = wait_events_until(get_time_ns() + NSEC_PER_SEC / drm.mode->vrefresh);
+		} else {
+			ret = drm.async_page_flip ? dispatch_events(0) : 0;
+		}
+		if (ret)
+			return -1;
+		if (event_loop_interrupted())
 			return 0;
+
+		if (idle) {
+			skipped++;
+			continue;
+		}
+
+		/* Rendering is not throttled by the flips */
+		if (drm.mailbox) {
+			if (present_mailbox(&mailbox, next_bo, flags)) {
+				printf("failed to commit: %s\n", strerror(errno));
+				return -1;
+			}
+			if (mailbox.pending)
+				flags &= ~(DRM_MODE_ATOMIC_ALLOW_MODESET);
+			continue;
+		}
+
+		/* Nothing was drawn yet, to be presented */
+		if (!fb)
+			continue;
+
+		if (wait_vblank_divisor(&drm)) {
+			printf("failed to wait for vblank: %s\n", strerror(errno));
+			return -1;
 		}
+		if (event_loop_interrupted())
+			return 0;
 
 		/*
 		 * Here you could also update drm plane layers if you want
 		 * hw composition
 		 */
-		ret = drm_atomic_commit(fb->fb_id, flags);
+		ret = drm_atomic_commit(fb->fb_id, flags, egl->damage ? damage : NULL);
 		if (ret) {
 			printf("failed to commit: %s\n", strerror(errno));
 			return -1;
 		}
 
 		if (!drm.async_page_flip) {
-			ret = drmHandleEvent(drm.fd, &evctx);
+			ret = wait_flip();
 			if (ret) {
 				printf("failed to wait for page flip completion\n");
 				return -1;
 			}
+			if (event_loop_interrupted())
+				return 0;
+			record_wakeup(drm.flip_time, get_time_ns());
+			if (draw)
+				record_presentation(drm.flip_time);
 		}
 
 		/* release last buffer to render on again: */
-		if (bo && gbm->surface)
+		if (bo && gbm->surface && bo != next_bo)
 			gbm_surface_release_buffer(gbm->surface, bo);
 		bo = next_bo;
 
-		/* Allow a modeset change for the first commit only. */
+		/* Allow a modeset change for the first commit, and the mode
+		 * switch, only.
+		 */
 		flags &= ~(DRM_MODE_ATOMIC_ALLOW_MODESET);
 	}
 
@@ -279,7 +517,22 @@ static int atomic_run(const struct gbm *gbm, const struct egl *egl)
 	printf("Rendered %u frames in %f sec (%f fps)\n",
 	       frames, secs, (double) frames / secs);
 
+	if (skipped)
+		printf("Skipped %u unchanged frames\n", skipped);
+	if (drm.vrr)
+		printf("VRR enabled, %u frames presented again below the range\n", repeats);
+	if (drm.mailbox)
+		printf("Presented %u frames, %u replaced by newer ones before their flip\n",
+		       mailbox.presented, mailbox.replaced);
+
 	dump_perfcntrs(frames, elapsed_time);
+	dump_playlist();
+	dump_quality();
+	dump_gpu_timers();
+	dump_pacing();
+	dump_realtime();
+	dump_thermal();
+	dump_gpu_stats();
 
 	return ret;
 }
@@ -298,7 +551,7 @@ const struct drm * init_drm_atomic(int fd, const struct options *options)
 	if (ret)
 		return NULL;
 
-	drm.run = atomic_run;
+	drm.run = drm.beam_slices ? beam_run : atomic_run;
 
 	return &drm;
 }
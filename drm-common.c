@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -403,6 +404,271 @@ const uint64_t *get_drm_format_modifiers(const struct drm *drm,
 	return NULL;
 }
 
+/* Share of the maximum refresh rate, to cap the frame rate at with VRR */
+#define VRR_CAP 0.97f
+/* Share of the sustained render rate, to present frames at */
+#define RATE_HEADROOM 0.95f
+/* Lowest presentation rate, as a divisor of the refresh rate */
+#define MAX_RATE_DIVISOR 4
+
+static float mode_refresh(const drmModeModeInfo *mode)
+{
+	return mode->clock * 1000.0f / (mode->htotal * mode->vtotal);
+}
+
+/* Collects the modes of the resolution of the current one, once per refresh
+ * rate, starting with the current one, to select from.
+ */
+static void find_refresh_rates(struct drm *drm, const drmModeConnector *connector)
+{
+	const drmModeModeInfo *current = drm->mode;
+
+	drm->modes[drm->count_modes++] = drm->mode;
+	for (int i = 0; i < connector->count_modes && drm->count_modes < MAX_MODES; i++) {
+		drmModeModeInfo *mode = &connector->modes[i];
+		bool duplicate = false;
+
+		if (mode->hdisplay != current->hdisplay || mode->vdisplay != current->vdisplay ||
+		    (mode->flags & DRM_MODE_FLAG_INTERLACE) != (current->flags & DRM_MODE_FLAG_INTERLACE))
+			continue;
+
+		for (unsigned int j = 0; j < drm->count_modes; j++) {
+			if (drm->modes[j]->vrefresh == mode->vrefresh)
+				duplicate = true;
+		}
+		if (duplicate)
+			continue;
+
+		drm->modes[drm->count_modes++] = mode;
+	}
+
+	printf("Adapting the refresh rate of %ux%u to the render rate, among", current->hdisplay, current->vdisplay);
+	for (unsigned int j = 0; j < drm->count_modes; j++)
+		printf(" %.2f", mode_refresh(drm->modes[j]));
+	printf(" Hz\n");
+}
+
+/* Selects the mode, and the vblank divisor, which present frames at the
+ * highest rate the sustained render rate holds, at an even cadence. Returns
+ * whether the mode changed.
+ */
+bool select_refresh_rate(struct drm *drm, float rate)
+{
+	drmModeModeInfo *best = drm->mode;
+	unsigned int best_divisor = drm->vblank_divisor;
+	float best_rate = 0.0f;
+
+	for (unsigned int i = 0; i < drm->count_modes; i++) {
+		float refresh = mode_refresh(drm->modes[i]);
+		unsigned int divisor = MAX2(1, (unsigned int) ceilf(refresh / (RATE_HEADROOM * rate)));
+
+		if (divisor > MAX_RATE_DIVISOR)
+			continue;
+
+		/* the same rate is smoother without skipped vblanks */
+		float presented = refresh / divisor;
+		if (presented > best_rate + 0.01f ||
+		    (presented > best_rate - 0.01f && divisor < best_divisor)) {
+			best = drm->modes[i];
+			best_divisor = divisor;
+			best_rate = presented;
+		}
+	}
+
+	if (!best_rate) {
+		printf("Rendering at %.2f fps, below all the refresh rates, keeping %s@%.2f Hz\n",
+		       rate, drm->mode->name, mode_refresh(drm->mode));
+		return false;
+	}
+
+	printf("Rendering at %.2f fps, presenting at %.2f Hz on %s@%.2f Hz",
+	       rate, best_rate, best->name, mode_refresh(best));
+	if (best_divisor > 1)
+		printf(", every %u vblanks", best_divisor);
+	printf("\n");
+
+	bool changed = best != drm->mode;
+	drm->mode = best;
+	drm->vblank_divisor = best_divisor;
+
+	if (changed) {
+		pacing_refresh_changed(mode_refresh(best));
+		thermal_refresh_changed(mode_refresh(best));
+	}
+
+	return changed;
+}
+
+/* Whether the vblank queued by wait_vblank_divisor() is still pending */
+static bool waiting_for_vblank;
+
+void vblank_handler(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *data)
+{
+	/* suppress 'unused parameter' warnings */
+	(void) fd, (void) sequence, (void) sec, (void) usec, (void) data;
+
+	waiting_for_vblank = false;
+}
+
+void sequence_handler(int fd, uint64_t sequence, uint64_t ns, uint64_t user_data)
+{
+	/* suppress 'unused parameter' warnings */
+	(void) fd, (void) sequence, (void) ns, (void) user_data;
+
+	waiting_for_vblank = false;
+}
+
+/* Waits for the vblank before the one vblank_divisor vblanks after the last
+ * page flip, for the next page flip to complete on the latter.  The vblank
+ * event is queued, and dispatched by the DRM event source of the run loop,
+ * along with the other events, until it arrives or the user interrupts.
+ */
+int wait_vblank_divisor(const struct drm *drm)
+{
+	uint32_t target = drm->flip_sequence + drm->vblank_divisor - 1;
+	uint64_t sequence, queued;
+	int ret;
+
+	if (drm->vblank_divisor < 2)
+		return 0;
+
+	ret = drmCrtcGetSequence(drm->fd, drm->crtc_id, &sequence, NULL);
+	if (ret) {
+		/* Kernels before 4.15 only have the legacy vblank ioctl, which
+		 * sends the event at once when the target has passed
+		 */
+		drmVBlank vbl = {
+				.request = {
+						.type = DRM_VBLANK_ABSOLUTE | DRM_VBLANK_EVENT |
+						        ((drm->crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+						         DRM_VBLANK_HIGH_CRTC_MASK),
+						.sequence = target,
+				},
+		};
+		ret = drmWaitVBlank(drm->fd, &vbl);
+	} else {
+		/* Page flip events only carry the low 32 bits of the sequence */
+		int32_t remaining = target - (uint32_t) sequence;
+		if (remaining <= 0)
+			return 0;
+
+		ret = drmCrtcQueueSequence(drm->fd, drm->crtc_id, 0, sequence + remaining, &queued, 0);
+	}
+	if (ret)
+		return ret;
+
+	waiting_for_vblank = true;
+	while (waiting_for_vblank && !event_loop_interrupted()) {
+		if (dispatch_events(-1))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Takes the newest completed frame, if any, in place of the queued one, and
+ * returns the frame to flip to, once no flip is pending.
+ */
+struct gbm_bo *mailbox_next(struct mailbox *mailbox, struct gbm_bo *bo)
+{
+	if (bo) {
+		if (mailbox->queued) {
+			gbm_surface_release_buffer(mailbox->surface, mailbox->queued);
+			mailbox->replaced++;
+		}
+		mailbox->queued = bo;
+	}
+
+	if (mailbox->pending || !mailbox->queued)
+		return NULL;
+
+	mailbox->pending = mailbox->queued;
+	mailbox->queued = NULL;
+
+	return mailbox->pending;
+}
+
+/* Accounts for the pending flip, completed at time */
+void mailbox_flipped(struct mailbox *mailbox, uint64_t time)
+{
+	if (mailbox->scanout && mailbox->scanout != mailbox->pending)
+		gbm_surface_release_buffer(mailbox->surface, mailbox->scanout);
+	mailbox->scanout = mailbox->pending;
+	mailbox->pending = NULL;
+	mailbox->presented++;
+
+	record_presentation(time);
+}
+
+static bool get_connector_property(const struct drm *drm, const char *name, uint64_t *value)
+{
+	struct connector *obj = drm->connector;
+
+	for (unsigned int i = 0; i < obj->props->count_props; i++) {
+		if (strcmp(obj->props_info[i]->name, name) == 0) {
+			*value = obj->props->prop_values[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Find the vertical refresh range, from the display range limits descriptor
+ * of the EDID.
+ */
+static bool get_refresh_range(const struct drm *drm, float *min, float *max)
+{
+	drmModePropertyBlobRes *blob;
+	uint64_t blob_id;
+	bool found = false;
+
+	if (!get_connector_property(drm, "EDID", &blob_id) || !blob_id)
+		return false;
+
+	blob = drmModeGetPropertyBlob(drm->fd, blob_id);
+	if (!blob)
+		return false;
+
+	/* the 4 display descriptors of the base block */
+	const uint8_t *edid = blob->data;
+	for (unsigned int offset = 54; offset + 18 <= 126 && offset + 18 <= blob->length; offset += 18) {
+		const uint8_t *d = &edid[offset];
+
+		if (d[0] == 0 && d[1] == 0 && d[2] == 0 && d[3] == 0xfd) {
+			/* rate offsets of 255 Hz, for the high refresh rates */
+			*min = d[5] + (d[4] & 0x1 ? 255 : 0);
+			*max = d[6] + (d[4] & 0x2 ? 255 : 0);
+			found = *min > 0 && *max > *min;
+			break;
+		}
+	}
+
+	drmModeFreePropertyBlob(blob);
+
+	return found;
+}
+
+static void init_vrr(struct drm *drm, float refresh)
+{
+	uint64_t capable = 0;
+
+	if (!get_connector_property(drm, "vrr_capable", &capable) || !capable) {
+		printf("Connector is not VRR capable, using a fixed refresh rate\n");
+		return;
+	}
+
+	if (!get_refresh_range(drm, &drm->vrr_min, &drm->vrr_max)) {
+		drm->vrr_min = refresh / 2;
+		drm->vrr_max = refresh;
+		printf("No refresh range in the EDID, assuming %.0f-%.0f Hz\n", drm->vrr_min, drm->vrr_max);
+	}
+	drm->vrr_max = MIN2(drm->vrr_max, refresh);
+
+	drm->vrr = true;
+	printf("Using a variable refresh rate, within %.0f-%.0f Hz\n", drm->vrr_min, drm->vrr_max);
+}
+
 int init_drm(struct drm *drm, const int fd, const struct options *options)
 {
 	drmModeRes *resources;
@@ -412,7 +678,10 @@ int init_drm(struct drm *drm, const int fd, const struct options *options)
 
 	drm->fd = fd;
 	drm->async_page_flip = options->async_page_flip;
+	drm->mailbox = options->mailbox;
+	drm->beam_slices = options->beam_slices;
 	drm->frames = options->frames;
+	drm->vblank_divisor = MAX2(1, options->vblank_divisor);
 
 	get_resources(drm->fd, &resources);
 	if (!resources) {
@@ -551,5 +820,33 @@ int init_drm(struct drm *drm, const int fd, const struct options *options)
 
 	get_plane_format_modifiers(drm);
 
+	float refresh = mode_refresh(drm->mode);
+	float max_fps = options->max_fps;
+
+	if (options->adaptive_mode) {
+		find_refresh_rates(drm, connector);
+	}
+
+	if (options->vrr) {
+		init_vrr(drm, refresh);
+	}
+
+	/* Cap the frame rate just below the range, for the frames to be
+	 * presented as soon as they are ready, rather than on a vblank.
+	 */
+	if (drm->vrr) {
+		max_fps = max_fps > 0 ? MIN2(max_fps, VRR_CAP * drm->vrr_max) : VRR_CAP * drm->vrr_max;
+	}
+
+	init_pacing(options->render_rate, refresh);
+	init_frame_cap(max_fps);
+	init_gpu_stats(drm->fd);
+
+	if (init_realtime(options, refresh))
+		return -1;
+
+	if (init_thermal(options, refresh, max_fps))
+		return -1;
+
 	return 0;
 }
@@ -27,6 +27,8 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#define MAX_MODES 16
+
 struct plane {
 	drmModePlane *plane;
 	drmModeObjectProperties *props;
@@ -58,14 +60,31 @@ struct drm {
 	int crtc_index;
 
 	drmModeModeInfo *mode;
+	/* modes of the same resolution, to adapt the refresh rate to: */
+	drmModeModeInfo *modes[MAX_MODES];
+	unsigned int count_modes;
 	uint32_t crtc_id;
 	uint32_t connector_id;
 
 	bool async_page_flip;
+	bool mailbox;
 
 	/* number of frames to run for: */
 	unsigned int frames;
 
+	/* present on every Nth vblank, after the last page flip: */
+	unsigned int vblank_divisor;
+	unsigned int flip_sequence;
+	/* time of the last page flip, in ns: */
+	uint64_t flip_time;
+
+	/* variable refresh rate, within the range of the panel, in Hz: */
+	bool vrr;
+	float vrr_min, vrr_max;
+
+	/* render into the scanned out buffer, in slices, racing the beam: */
+	unsigned int beam_slices;
+
 	int (*run)(const struct gbm *gbm, const struct egl *egl);
 };
 
@@ -76,6 +95,17 @@ struct drm_fb {
 
 struct drm_fb * drm_fb_get_from_bo(struct gbm_bo *bo);
 
+/* Buffers of the mailbox presentation, locked from the GBM surface */
+struct mailbox {
+	struct gbm_surface *surface;
+	struct gbm_bo *scanout, *pending, *queued;
+	unsigned int presented, replaced;
+};
+
+struct gbm_bo *mailbox_next(struct mailbox *mailbox, struct gbm_bo *bo);
+
+void mailbox_flipped(struct mailbox *mailbox, uint64_t time);
+
 int find_drm_device();
 
 int find_plane_prop(const struct drm *drm, const char *name, unsigned int *prop_idx);
@@ -84,6 +114,16 @@ const uint64_t *get_drm_format_modifiers(const struct drm *drm, unsigned int *co
 
 int init_drm(struct drm *drm, int fd, const struct options *options);
 
+void vblank_handler(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *data);
+
+void sequence_handler(int fd, uint64_t sequence, uint64_t ns, uint64_t user_data);
+
+int wait_vblank_divisor(const struct drm *drm);
+
+bool select_refresh_rate(struct drm *drm, float rate);
+
+int beam_run(const struct gbm *gbm, const struct egl *egl);
+
 const struct drm *init_drm_legacy(int fd, const struct options *options);
 
 const struct drm *init_drm_atomic(int fd, const struct options *options);
@@ -25,7 +25,6 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/select.h>
 
 #include "common.h"
 #include "drm-common.h"
@@ -36,25 +35,67 @@ static void page_flip_handler(int fd, unsigned int frame,
                               unsigned int sec, unsigned int usec, void *data)
 {
 	/* suppress 'unused parameter' warnings */
-	(void) fd, (void) frame, (void) sec, (void) usec;
+	(void) fd;
+
+	drm.flip_sequence = frame;
+	drm.flip_time = sec * NSEC_PER_SEC + usec * (NSEC_PER_SEC / USEC_PER_SEC);
 
 	int *waiting_for_flip = data;
 	*waiting_for_flip = 0;
 }
 
+static void handle_drm_events(int fd, void *data)
+{
+	if (drmHandleEvent(fd, data))
+		printf("failed to handle DRM events: %s\n", strerror(errno));
+}
+
+/* Completes the pending flip, if any, without waiting for it, then flips to
+ * the newest completed frame, bo, or the one queued during the last render.
+ */
+static int present_mailbox(struct mailbox *mailbox, struct gbm_bo *bo, int *waiting_for_flip)
+{
+	struct gbm_bo *flip;
+	struct drm_fb *fb;
+
+	if (dispatch_events(0))
+		return -1;
+	if (mailbox->pending && !*waiting_for_flip)
+		mailbox_flipped(mailbox, drm.flip_time);
+
+	flip = mailbox_next(mailbox, bo);
+	if (!flip)
+		return 0;
+
+	fb = drm_fb_get_from_bo(flip);
+	if (!fb)
+		return -1;
+
+	*waiting_for_flip = 1;
+	return drmModePageFlip(drm.fd, drm.crtc_id, fb->fb_id,
+	                       DRM_MODE_PAGE_FLIP_EVENT, waiting_for_flip);
+}
+
 static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 {
-	fd_set fds;
 	drmEventContext evctx = {
-			.version = 2,
+			.version = 4,
 			.page_flip_handler = page_flip_handler,
+			.vblank_handler = vblank_handler,
+			.sequence_handler = sequence_handler,
 	};
 	struct gbm_bo *bo;
 	struct drm_fb *fb;
-	uint32_t i = 0;
+	uint32_t i = 0, rendered = 0, drawn = 0, skipped = 0;
 	uint64_t start_time, report_time, cur_time;
 	int ret;
 
+	/* frames presented at vblank, in place of the queued ones */
+	struct mailbox mailbox = {
+			.surface = gbm->surface,
+	};
+	int mailbox_waiting_for_flip = 0;
+
 	if (gbm->surface) {
 		eglSwapBuffers(egl->display, egl->surface);
 		bo = gbm_surface_lock_front_buffer(gbm->surface);
@@ -83,10 +124,18 @@ static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 		flags = DRM_MODE_PAGE_FLIP_EVENT;
 	}
 
+	mailbox.scanout = bo;
+
+	if (add_event_source(drm.fd, handle_drm_events, &evctx)) {
+		printf("failed to watch DRM events: %s\n", strerror(errno));
+		return -1;
+	}
+
+	start_realtime();
+
 	start_time = report_time = get_time_ns();
 
 	while (drm.frames == 0 || i < drm.frames) {
-		unsigned frame = i;
 		struct gbm_bo *next_bo;
 		int waiting_for_flip = 1;
 
@@ -97,8 +146,28 @@ static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 			start_time = report_time = get_time_ns();
 		}
 
+		wait_frame_cap();
+
+		if (drm.mailbox && present_mailbox(&mailbox, NULL, &mailbox_waiting_for_flip)) {
+			printf("failed to present the queued frame: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* Frames that do not change are not presented again, until
+		 * they do.  The damage is not used, as page flips can't
+		 * carry it.
+		 */
+		int damage[4];
+		bool idle = egl->damage && !egl->damage(damage);
+
+		/* Vblanks between renders present the last one again, unless
+		 * the renderer presents frames in between.
+		 */
+		bool render = !idle && start_pacing_frame(get_time_ns());
+		bool draw = render || (!idle && egl->present);
+
 		if (!gbm->surface) {
-			glBindFramebuffer(GL_FRAMEBUFFER, egl->fbs[frame % NUM_BUFFERS].fb);
+			glBindFramebuffer(GL_FRAMEBUFFER, egl->fbs[drawn % NUM_BUFFERS].fb);
 		}
 
 		// Calculate current FPS
@@ -110,26 +179,82 @@ static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 			}
 		}
 
-		egl->draw(start_time, i++, fps);
+		if (render) {
+			egl->draw(start_time, rendered++, fps);
+		} else if (draw) {
+			egl->present(pacing_progress(), fps);
+		}
+		/* Only the presented frames count, not the idle refresh intervals */
+		if (!idle)
+			i++;
+
+		if (draw) {
+			/* Block until all the buffered GL operations are completed.
+			 * This is required on NVIDIA GPUs, for which the DRM drivers
+			 * do not wait for the rendering to complete, upon executing
+			 * page flipping operations, such as drmModePageFlip().
+			 */
+			if (finish_render(egl))
+				return -1;
+			end_pacing_frame(get_time_ns());
+
+			if (gbm->surface) {
+				eglSwapBuffers(egl->display, egl->surface);
+				next_bo = gbm_surface_lock_front_buffer(gbm->surface);
+			} else {
+				next_bo = gbm->bos[drawn % NUM_BUFFERS];
+			}
+			fb = drm_fb_get_from_bo(next_bo);
+			if (!fb) {
+				fprintf(stderr, "Failed to get a new framebuffer BO\n");
+				return -1;
+			}
+			drawn++;
+		} else {
+			next_bo = bo;
+		}
+
+		cur_time = get_time_ns();
+		sample_gpu_stats(cur_time);
+		if (cur_time > (report_time + 2 * NSEC_PER_SEC)) {
+			double elapsed_time = cur_time - start_time;
+			double secs = elapsed_time / (double) NSEC_PER_SEC;
+			unsigned frames = i - 1;  /* first frame ignored */
+			printf("Rendered %u frames in %f sec (%f fps)\n",
+			       frames, secs, (double) frames / secs);
+			if (skipped)
+				printf("Skipped %u unchanged frames\n", skipped);
+			report_time = cur_time;
+		}
 
-		/* Block until all the buffered GL operations are completed.
-		 * This is required on NVIDIA GPUs, for which the DRM drivers
-		 * do not wait for the rendering to complete, upon executing
-		 * page flipping operations, such as drmModePageFlip().
-		 */
-		glFinish();
+		if (event_loop_interrupted())
+			return 0;
 
-		if (gbm->surface) {
-			eglSwapBuffers(egl->display, egl->surface);
-			next_bo = gbm_surface_lock_front_buffer(gbm->surface);
-		} else {
-			next_bo = gbm->bos[frame % NUM_BUFFERS];
+		/* Rendering is not throttled by the flips */
+		if (drm.mailbox) {
+			if (present_mailbox(&mailbox, next_bo, &mailbox_waiting_for_flip)) {
+				printf("failed to queue page flip: %s\n", strerror(errno));
+				return -1;
+			}
+			continue;
 		}
-		fb = drm_fb_get_from_bo(next_bo);
-		if (!fb) {
-			fprintf(stderr, "Failed to get a new framebuffer BO\n");
+
+		/* Idle for a refresh interval, instead of the page flip */
+		if (idle) {
+			if (wait_events_until(get_time_ns() + NSEC_PER_SEC / drm.mode->vrefresh))
+				return -1;
+			if (event_loop_interrupted())
+				return 0;
+			skipped++;
+			continue;
+		}
+
+		if (wait_vblank_divisor(&drm)) {
+			printf("failed to wait for vblank: %s\n", strerror(errno));
 			return -1;
 		}
+		if (event_loop_interrupted())
+			return 0;
 
 		/*
 		 * Here you could also update drm plane layers if you want
@@ -145,37 +270,21 @@ static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 
 		if (!drm.async_page_flip) {
 			while (waiting_for_flip) {
-				FD_ZERO(&fds);
-				FD_SET(0, &fds);
-				FD_SET(drm.fd, &fds);
-
-				ret = select(drm.fd + 1, &fds, NULL, NULL, NULL);
-				if (ret < 0) {
-					printf("select err: %s\n", strerror(errno));
+				ret = dispatch_events(-1);
+				if (ret)
 					return ret;
-				} else if (ret == 0) {
-					printf("select timeout!\n");
-					return -1;
-				} else if (FD_ISSET(0, &fds)) {
-					printf("user interrupted!\n");
+				if (event_loop_interrupted())
 					return 0;
-				}
-				drmHandleEvent(drm.fd, &evctx);
 			}
-		}
-
-		cur_time = get_time_ns();
-		if (cur_time > (report_time + 2 * NSEC_PER_SEC)) {
-			double elapsed_time = cur_time - start_time;
-			double secs = elapsed_time / (double) NSEC_PER_SEC;
-			unsigned frames = i - 1;  /* first frame ignored */
-			printf("Rendered %u frames in %f sec (%f fps)\n",
-			       frames, secs, (double) frames / secs);
-			report_time = cur_time;
+			record_wakeup(drm.flip_time, get_time_ns());
+			if (draw)
+				record_presentation(drm.flip_time);
+		} else if (dispatch_events(0)) {
+			return -1;
 		}
 
 		/* release last buffer to render on again: */
-		if (gbm->surface) {
+		if (gbm->surface && bo != next_bo) {
 			gbm_surface_release_buffer(gbm->surface, bo);
 		}
 		bo = next_bo;
@@ -190,7 +299,17 @@ static int legacy_run(const struct gbm *gbm, const struct egl *egl)
 	printf("Rendered %u frames in %f sec (%f fps)\n",
 	       frames, secs, (double) frames / secs);
 
+	if (skipped)
+		printf("Skipped %u unchanged frames\n", skipped);
+
 	dump_perfcntrs(frames, elapsed_time);
+	dump_playlist();
+	dump_quality();
+	dump_gpu_timers();
+	dump_pacing();
+	dump_realtime();
+	dump_thermal();
+	dump_gpu_stats();
 
 	return 0;
 }
@@ -209,7 +328,7 @@ const struct drm * init_drm_legacy(int fd, const struct options *options)
 	if (ret)
 		return NULL;
 
-	drm.run = legacy_run;
+	drm.run = drm.beam_slices ? beam_run : legacy_run;
 
 	return &drm;
 }
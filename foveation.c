@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/* Module to render the image pass foveated: the focus region is rendered at
+ * the full resolution, and rings around it at halved resolutions, each level
+ * into its own target, then composited from the outermost one, with the
+ * borders of the inner levels faded into the outer ones.  The focus region
+ * is fixed, or follows the last click of iMouse.
+ */
+
+#define MAX_FOVEATION_RINGS 3
+#define FOVEATION_FEATHER 0.1f
+
+static struct {
+	struct shading_rate rate;
+	int width, height;
+	bool follow_mouse;
+	unsigned count;
+	// Levels, from the focus region to the whole screen
+	struct {
+		int x, y, width, height;
+		// Render target, at the resolution of the level
+		int fb_width, fb_height;
+		struct framebuffer fb;
+	} levels[MAX_FOVEATION_RINGS + 1];
+	GLuint program;
+	GLint feather;
+	GLuint unit;
+	// Region uniform of the image program
+	GLuint image_program;
+	GLint image_region;
+	int timer;
+} foveation;
+
+static const char *foveation_declarations =
+		"uniform vec4 kms_region;\n"
+		"#define kms_FragCoord (gl_FragCoord.xy * kms_region.xy + kms_region.zw)\n";
+
+static const char *foveation_fs =
+		"precision mediump float;                                     \n"
+		"                                                             \n"
+		"uniform sampler2D level;                                     \n"
+		"uniform float feather;                                       \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    // Fade the border into the outer level                 \n"
+		"    vec2 edge = clamp(min(uv, 1.0 - uv) / feather, 0.0, 1.0);\n"
+		"    gl_FragColor = vec4(texture2D(level, uv).rgb, edge.x * edge.y);\n"
+		"}                                                            \n";
+
+/* Center the levels on the focus point, within the screen */
+static void place_foveation(float x, float y)
+{
+	for (unsigned i = 0; i < foveation.count; i++) {
+		int width = foveation.levels[i].width, height = foveation.levels[i].height;
+
+		foveation.levels[i].x = MIN2(MAX2(0, (int) (x - width / 2)), foveation.width - width);
+		foveation.levels[i].y = MIN2(MAX2(0, (int) (y - height / 2)), foveation.height - height);
+	}
+}
+
+static void begin_foveation(GLuint program, unsigned frame, const GLfloat mouse[4])
+{
+	(void) frame;
+
+	if (foveation.image_program != program) {
+		foveation.image_program = program;
+		foveation.image_region = glGetUniformLocation(program, "kms_region");
+	}
+
+	// iMouse is the last click, or unset
+	if (foveation.follow_mouse && (mouse[0] || mouse[1])) {
+		place_foveation(mouse[0], mouse[1]);
+	}
+}
+
+/* Each level is a draw of the image pass, at its resolution */
+static bool draw_foveation(GLuint program, unsigned i)
+{
+	if (i >= foveation.count)
+		return false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, foveation.levels[i].fb.fb);
+	glViewport(0, 0, foveation.levels[i].fb_width, foveation.levels[i].fb_height);
+	glUseProgram(program);
+	glUniform4f(foveation.image_region,
+	            (float) foveation.levels[i].width / foveation.levels[i].fb_width,
+	            (float) foveation.levels[i].height / foveation.levels[i].fb_height,
+	            foveation.levels[i].x, foveation.levels[i].y);
+
+	return true;
+}
+
+static void resolve_foveation(GLuint target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glUseProgram(foveation.program);
+	glActiveTexture(GL_TEXTURE0 + foveation.unit);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	begin_gpu_timer(foveation.timer);
+	for (int i = foveation.count - 1; i >= 0; i--) {
+		glViewport(foveation.levels[i].x, foveation.levels[i].y,
+		           foveation.levels[i].width, foveation.levels[i].height);
+		glBindTexture(GL_TEXTURE_2D, foveation.levels[i].fb.tex);
+		// The outermost level covers the screen
+		glUniform1f(foveation.feather, i == (int) foveation.count - 1 ? 1e-6f : FOVEATION_FEATHER);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+	end_gpu_timer(foveation.timer);
+	glDisable(GL_BLEND);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/* Sets up the foveated rendering of a width x height image pass, parsing
+ * center|mouse|X,Y,WxH[:rings=N], the focus region and its rings.
+ */
+const struct shading_rate *init_foveation(int width, int height, const char *layout)
+{
+	char *str = strdup(layout), *saveptr, *token;
+	int x = -1, y = -1, region_width = width / 3, region_height = height / 3;
+	unsigned rings = 2;
+	float shaded = 0.0f;
+	int ret;
+
+	foveation.width = width;
+	foveation.height = height;
+
+	token = strtok_r(str, ":", &saveptr);
+	if (!token) {
+		goto err;
+	}
+	if (strcmp(token, "mouse") == 0) {
+		foveation.follow_mouse = true;
+	} else if (strcmp(token, "center") != 0 &&
+	           (sscanf(token, "%d,%d,%dx%d", &x, &y, &region_width, &region_height) != 4 ||
+	            x < 0 || y < 0 || region_width <= 0 || region_height <= 0 ||
+	            x + region_width > width || y + region_height > height)) {
+		printf("invalid foveation region '%s'\n", token);
+		goto err;
+	}
+
+	while ((token = strtok_r(NULL, ":", &saveptr))) {
+		if (sscanf(token, "rings=%u", &rings) != 1 || rings < 1 || rings > MAX_FOVEATION_RINGS) {
+			printf("invalid foveation option '%s'\n", token);
+			goto err;
+		}
+	}
+	free(str);
+
+	// Each ring doubles the size of the region, the last one covers the screen
+	foveation.count = rings + 1;
+	for (unsigned i = 0; i < foveation.count; i++) {
+		bool last = i == foveation.count - 1;
+
+		foveation.levels[i].width = last ? width : MIN2(region_width << i, width);
+		foveation.levels[i].height = last ? height : MIN2(region_height << i, height);
+		foveation.levels[i].fb_width = MAX2(1, foveation.levels[i].width >> i);
+		foveation.levels[i].fb_height = MAX2(1, foveation.levels[i].height >> i);
+		if (!create_offscreen_framebuffer(&foveation.levels[i].fb,
+		                                  foveation.levels[i].fb_width, foveation.levels[i].fb_height,
+		                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE)) {
+			return NULL;
+		}
+		shaded += (float) foveation.levels[i].fb_width * foveation.levels[i].fb_height;
+	}
+
+	if (x < 0) {
+		place_foveation(width / 2.0f, height / 2.0f);
+	} else {
+		place_foveation(x + region_width / 2.0f, y + region_height / 2.0f);
+	}
+
+	ret = create_quad_program(foveation_fs);
+	if (ret < 0) {
+		return NULL;
+	}
+	foveation.program = ret;
+
+	foveation.unit = reserve_texture_unit();
+
+	glUseProgram(foveation.program);
+	glUniform1i(glGetUniformLocation(foveation.program, "level"), foveation.unit);
+	foveation.feather = glGetUniformLocation(foveation.program, "feather");
+
+	foveation.timer = create_gpu_timer("foveation composite");
+
+	foveation.rate = (struct shading_rate) {
+			.declarations = foveation_declarations,
+			.begin = begin_foveation,
+			.draw = draw_foveation,
+			.resolve = resolve_foveation,
+	};
+
+	printf("Foveated rendering of a %dx%d region and %u rings, shading %.0f%% of the pixels\n",
+	       foveation.levels[0].width, foveation.levels[0].height, rings,
+	       100.0f * shaded / (width * height));
+
+	return &foveation.rate;
+
+err:
+	free(str);
+	return NULL;
+}
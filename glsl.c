@@ -39,12 +39,44 @@ static const struct egl *egl;
 static const struct gbm *gbm;
 static const struct drm *drm;
 
-static const char *shortopts = "aAC:D:f:hHm:n:p:v:x";
+static const char *shortopts = "aAC:d:D:f:hHm:n:p:Sv:wx";
+
+enum {
+	OPT_CACHE_DIR = 256,
+	OPT_NO_CACHE,
+	OPT_PRECOMPILE,
+	OPT_PLAYLIST,
+	OPT_CROSSFADE,
+	OPT_BUFFER,
+	OPT_CHANNEL,
+	OPT_BENCHMARK_SPECIALIZE,
+	OPT_PRECISION,
+	OPT_TARGET_FPS,
+	OPT_COMPUTE,
+	OPT_CHECKERBOARD,
+	OPT_TAAU,
+	OPT_UPSCALE,
+	OPT_RENDER_RATE,
+	OPT_INTERPOLATE,
+	OPT_FOVEATE,
+	OPT_SKIP_STATIC,
+	OPT_MAX_FPS,
+	OPT_VBLANK_DIVISOR,
+	OPT_VRR,
+	OPT_ADAPTIVE_MODE,
+	OPT_MAILBOX,
+	OPT_BEAM_RACING,
+	OPT_REALTIME,
+	OPT_CPU_AFFINITY,
+	OPT_THERMAL_LIMIT,
+	OPT_SYSFS_ROOT,
+};
 
 static const struct option longopts[] = {
 		{"async",        no_argument,       0, 'a'},
 		{"atomic",       no_argument,       0, 'A'},
 		{"connector",    required_argument, 0, 'C'},
+		{"define",       required_argument, 0, 'd'},
 		{"device",       required_argument, 0, 'D'},
 		{"format",       required_argument, 0, 'f'},
 		{"help",         no_argument,       0, 'h'},
@@ -52,18 +84,60 @@ static const struct option longopts[] = {
 		{"modifier",     required_argument, 0, 'm'},
 		{"frames",       required_argument, 0, 'n'},
 		{"perfcntr",     required_argument, 0, 'p'},
+		{"specialize",   no_argument,       0, 'S'},
 		{"vmode",        required_argument, 0, 'v'},
+		{"watch",        no_argument,       0, 'w'},
 		{"surfaceless",  no_argument,       0, 'x'},
+		{"cache-dir",    required_argument, 0, OPT_CACHE_DIR},
+		{"no-cache",     no_argument,       0, OPT_NO_CACHE},
+		{"precompile",   required_argument, 0, OPT_PRECOMPILE},
+		{"playlist",     required_argument, 0, OPT_PLAYLIST},
+		{"crossfade",    required_argument, 0, OPT_CROSSFADE},
+		{"buffer",       required_argument, 0, OPT_BUFFER},
+		{"channel",      required_argument, 0, OPT_CHANNEL},
+		{"benchmark-specialize", required_argument, 0, OPT_BENCHMARK_SPECIALIZE},
+		{"precision",    required_argument, 0, OPT_PRECISION},
+		{"target-fps",   required_argument, 0, OPT_TARGET_FPS},
+		{"compute",      no_argument,       0, OPT_COMPUTE},
+		{"checkerboard", no_argument,       0, OPT_CHECKERBOARD},
+		{"taau",         required_argument, 0, OPT_TAAU},
+		{"upscale",      required_argument, 0, OPT_UPSCALE},
+		{"render-rate",  required_argument, 0, OPT_RENDER_RATE},
+		{"interpolate",  no_argument,       0, OPT_INTERPOLATE},
+		{"foveate",      required_argument, 0, OPT_FOVEATE},
+		{"skip-static",  no_argument,       0, OPT_SKIP_STATIC},
+		{"max-fps",      required_argument, 0, OPT_MAX_FPS},
+		{"vblank-divisor", required_argument, 0, OPT_VBLANK_DIVISOR},
+		{"vrr",          no_argument,       0, OPT_VRR},
+		{"adaptive-mode", no_argument,      0, OPT_ADAPTIVE_MODE},
+		{"mailbox",      no_argument,       0, OPT_MAILBOX},
+		{"beam-racing",  required_argument, 0, OPT_BEAM_RACING},
+		{"realtime",     required_argument, 0, OPT_REALTIME},
+		{"cpu-affinity", required_argument, 0, OPT_CPU_AFFINITY},
+		{"thermal-limit", required_argument, 0, OPT_THERMAL_LIMIT},
+		{"sysfs-root",   required_argument, 0, OPT_SYSFS_ROOT},
 		{0,              0,                 0, 0}
 };
 
+/* Upscaling presets, as ratios of the display resolution to the render one */
+static const struct {
+	const char *name;
+	float ratio;
+} upscale_modes[] = {
+		{"ultra",       1.3f},
+		{"quality",     1.5f},
+		{"balanced",    1.7f},
+		{"performance", 2.0f},
+};
+
 static void usage(const char *name) {
-	printf("Usage: %s [-aACDfhHmnpvx] <shader_file>\n"
+	printf("Usage: %s [-aACdDfhHmnpSvwx] <shader_file | --playlist=FILE | --precompile=DIR>\n"
 	       "\n"
 	       "options:\n"
 	       "    -a, --async              use async page flipping\n"
 	       "    -A, --atomic             use atomic mode setting and fencing\n"
 	       "    -C, --connector=ID       use the connector with the provided ID (see drm_info)\n"
+	       "    -d, --define=NAME=VALUE  override a #define of the shader source\n"
 	       "    -D, --device=DEVICE      use the given device\n"
 	       "    -f, --format=FOURCC      framebuffer format\n"
 	       "    -h, --help               print usage\n"
@@ -71,18 +145,181 @@ static void usage(const char *name) {
 	       "    -m, --modifier=MODIFIER  hardcode the selected modifier\n"
 	       "    -n, --frames=N           run for the given number of frames and exit\n"
 	       "    -p, --perfcntr=LIST      sample specified performance counters using\n"
-	       "                             the AMD_performance_monitor extension (comma\n"
-	       "                             separated list)\n"
+	       "                             the AMD_performance_monitor or\n"
+	       "                             INTEL_performance_query extension (comma\n"
+	       "                             separated list of [GROUP/]COUNTER, NAME=EXPR\n"
+	       "                             derived metrics, or @PRESET)\n"
+	       "    -S, --specialize         compile the built-in inputs that are known at\n"
+	       "                             startup, e.g. iResolution, as constants\n"
 	       "    -v, --vmode=VMODE        specify the video mode in the format\n"
 	       "                             <mode>[-<vrefresh>]\n"
-	       "    -x, --surfaceless        use surfaceless mode, instead of GBM surface\n",
+	       "    -w, --watch              reload the shader file when it changes\n"
+	       "    -x, --surfaceless        use surfaceless mode, instead of GBM surface\n"
+	       "        --cache-dir=DIR      program binary cache directory\n"
+	       "                             (default: $XDG_CACHE_HOME/kms-glsl)\n"
+	       "        --no-cache           disable the program binary cache\n"
+	       "        --precompile=DIR     build and cache the programs for the shader\n"
+	       "                             files in the given directory, and exit\n"
+	       "        --playlist=FILE      cycle through the shaders listed in the given\n"
+	       "                             file, one '<shader_file> [seconds]' per line\n"
+	       "        --crossfade=SECS     crossfade between playlist shaders\n"
+	       "        --buffer=SPEC        add a Buffer A-D pass, rendered before the image\n"
+	       "                             pass, with SPEC as FILE[:format=rgba8|rgba16f]\n"
+	       "                             [:scale=S][:iChannelN=A-D]...\n"
+	       "        --channel=CH=X       bind buffer X (A-D) to the image pass channel\n"
+	       "                             CH, e.g. --channel=iChannel0=A\n"
+	       "        --benchmark-specialize=N\n"
+	       "                             render N frames with the generic and the\n"
+	       "                             specialized programs, and exit\n"
+	       "        --precision=PREC     float precision of the image pass, highp\n"
+	       "                             (default), mediump, or auto to select the\n"
+	       "                             fastest that renders correctly\n"
+	       "        --target-fps=FPS     switch between the quality levels of the\n"
+	       "                             shader '// @quality' knobs to hold FPS\n"
+	       "        --compute            run the image pass as a compute shader, with\n"
+	       "                             a tuned workgroup size (OpenGL ES 3.1)\n"
+	       "        --checkerboard       shade half of the pixels each frame, and\n"
+	       "                             reconstruct the others from the previous one\n"
+	       "        --taau=SCALE         render at SCALE of the resolution, e.g. 0.5,\n"
+	       "                             and upsample temporally to the full one\n"
+	       "        --upscale=MODE       render at a reduced resolution, upscaled with\n"
+	       "                             an edge-adaptive filter, with MODE as ultra,\n"
+	       "                             quality, balanced, performance, or a SCALE\n"
+	       "        --render-rate=HZ     render at HZ, or auto to lower the rate while\n"
+	       "                             the render time exceeds the refresh interval,\n"
+	       "                             and present the last render in between\n"
+	       "        --interpolate        present a blend of the last two renders in\n"
+	       "                             between, one render late\n"
+	       "        --foveate=LAYOUT     render a focus region at the full resolution,\n"
+	       "                             and rings around it at lower ones, with LAYOUT\n"
+	       "                             as center, mouse or X,Y,WxH[:rings=N]\n"
+	       "        --skip-static        render and present frames only when they\n"
+	       "                             change, for shaders without time inputs\n"
+	       "        --max-fps=FPS        cap the frame rate at FPS\n"
+	       "        --vblank-divisor=N   present on every Nth vblank\n"
+	       "        --vrr                use a variable refresh rate, when the\n"
+	       "                             connector supports it (atomic only)\n"
+	       "        --adaptive-mode      switch to the refresh rate of the mode\n"
+	       "                             resolution that best fits the render\n"
+	       "                             rate, after a warm-up (atomic only)\n"
+	       "        --mailbox            render unthrottled, and flip to the newest\n"
+	       "                             completed frame on each vblank\n"
+	       "        --beam-racing=SLICES render into the scanned out buffer, in\n"
+	       "                             SLICES horizontal slices ahead of the\n"
+	       "                             beam (surfaceless only)\n"
+	       "        --realtime=POLICY    run the render thread with the fifo, or\n"
+	       "                             deadline, real-time scheduling policy\n"
+	       "        --cpu-affinity=CPUS  run the render thread on CPUS, e.g. 2,3\n"
+	       "        --thermal-limit=C    cap the frame rate to hold the temperature\n"
+	       "                             below C degrees Celsius\n"
+	       "        --sysfs-root=DIR     read the thermal sensors from DIR, instead\n"
+	       "                             of /sys\n",
 	       name);
 }
 
-int init(const char *shadertoy, const struct options *options) {
-	int ret;
+/*
+ * Check the options that cannot be combined, for the command line and the
+ * Python wrapper alike.
+ */
+static int validate_options(const struct options *options) {
+	bool reduced_rate = options->checkerboard || options->taau > 0 || options->upscale > 0 ||
+	                    options->foveate;
+
+	// Only the initial program runs as a compute shader
+	if (options->compute && (options->playlist || options->watch || options->target_fps > 0 ||
+	                         reduced_rate)) {
+		printf("--compute only runs the initial shader, at a fixed quality\n");
+		return -1;
+	}
+
+	// Crossfades render the full frame
+	if (reduced_rate && options->playlist) {
+		printf("reduced shading rate modes are not supported with --playlist\n");
+		return -1;
+	}
+
+	// The image pass is rendered with one of the reduced shading rate modes at most
+	if (options->checkerboard + (options->taau > 0) + (options->upscale > 0) + !!options->foveate > 1) {
+		printf("at most one reduced shading rate mode is supported\n");
+		return -1;
+	}
+
+	// Reloads would replace the variants of the quality governor, and the
+	// playlist shaders have no buffers of their own
+	if ((options->watch || options->playlist) && options->target_fps > 0) {
+		printf("--target-fps is not supported with --watch or --playlist\n");
+		return -1;
+	}
+	if (options->playlist && (options->watch || options->buffers[0])) {
+		printf("--watch and --buffer are not supported with --playlist\n");
+		return -1;
+	}
+
+	// Tearing page flips are not synchronized to vblanks
+	if ((options->vblank_divisor > 1 || options->vrr) && options->async_page_flip) {
+		printf("--vblank-divisor and --vrr are not supported with async page flips\n");
+		return -1;
+	}
+
+	// VRR_ENABLED is only set with atomic commits, and vblanks are irregular
+	if (options->vrr && (!options->atomic_drm_mode || options->vblank_divisor > 1)) {
+		printf("--vrr requires atomic mode setting, without --vblank-divisor\n");
+		return -1;
+	}
+
+	// The mode is switched with an atomic commit, and sets the vblank divisor
+	if (options->adaptive_mode &&
+	    (!options->atomic_drm_mode || options->async_page_flip || options->vrr ||
+	     options->vblank_divisor > 1 || options->render_rate != 0)) {
+		printf("--adaptive-mode requires atomic mode setting, and sets the frame rate itself\n");
+		return -1;
+	}
+
+	// The mailbox locks up to three buffers of the GBM surface, and flips
+	// on its own cadence
+	if (options->mailbox &&
+	    (options->surfaceless || options->async_page_flip || options->vrr || options->adaptive_mode ||
+	     options->vblank_divisor > 1 || options->render_rate != 0 || options->skip_static)) {
+		printf("--mailbox requires a GBM surface, and flips on its own cadence\n");
+		return -1;
+	}
+
+	// Beam racing renders the image pass alone, in the single buffer of the
+	// surfaceless mode, and never flips
+	if (options->beam_slices == 1) {
+		printf("--beam-racing requires at least 2 slices\n");
+		return -1;
+	}
+	if (options->beam_slices &&
+	    (!options->surfaceless || options->async_page_flip || options->vrr || options->adaptive_mode ||
+	     options->mailbox || options->vblank_divisor > 1 || options->render_rate != 0 ||
+	     options->skip_static || options->playlist || options->target_fps > 0 || options->compute ||
+	     reduced_rate)) {
+		printf("--beam-racing requires the surfaceless mode, and renders the image pass alone\n");
+		return -1;
+	}
+
+	// Static content is probed on the initial shader, at its initial quality
+	if (options->skip_static && (options->playlist || options->watch || options->target_fps > 0)) {
+		printf("--skip-static only probes the initial shader, at a fixed quality\n");
+		return -1;
+	}
+
+	if (options->interpolate && options->render_rate == 0) {
+		printf("--interpolate requires --render-rate\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int init_display(const struct options *options) {
 	int fd;
 
+	if (validate_options(options) < 0) {
+		return -1;
+	}
+
 	if (options->device) {
 		fd = open(options->device, O_RDWR);
 	} else {
@@ -147,6 +384,19 @@ int init(const char *shadertoy, const struct options *options) {
 		return -1;
 	}
 
+	init_program_cache(egl, options);
+
+	return 0;
+}
+
+int init(const char *shadertoy, const struct options *options) {
+	int ret;
+
+	ret = init_display(options);
+	if (ret < 0) {
+		return -1;
+	}
+
 	ret = init_shadertoy(gbm, (struct egl *)egl, shadertoy, options);
 	if (ret < 0) {
 		return -1;
@@ -161,6 +411,8 @@ int init(const char *shadertoy, const struct options *options) {
 int main(int argc, char *argv[]) {
 	const char *shadertoy = NULL;
 	const char *perfcntr = NULL;
+	const char *precompile = NULL;
+	unsigned benchmark = 0;
 
 	struct options options = {
 			.connector = -1,
@@ -171,6 +423,8 @@ int main(int argc, char *argv[]) {
 
 	int ret;
 
+	unsigned num_buffers = 0;
+	unsigned num_defines = 0;
 	char *p;
 	int opt;
 	unsigned int len;
@@ -185,6 +439,17 @@ int main(int argc, char *argv[]) {
 			case 'C':
 				options.connector = strtoul(optarg, NULL, 0);
 				break;
+			case 'd':
+				if (num_defines == MAX_DEFINES) {
+					printf("at most %d defines are supported\n", MAX_DEFINES);
+					return -1;
+				}
+				if (!strchr(optarg, '=')) {
+					usage(argv[0]);
+					return -1;
+				}
+				options.defines[num_defines++] = optarg;
+				break;
 			case 'D':
 				options.device = optarg;
 				break;
@@ -217,6 +482,9 @@ int main(int argc, char *argv[]) {
 			case 'p':
 				perfcntr = optarg;
 				break;
+			case 'S':
+				options.specialize = true;
+				break;
 			case 'v':
 				p = strchr(optarg, '-');
 				if (p == NULL) {
@@ -230,28 +498,206 @@ int main(int argc, char *argv[]) {
 				strncpy(options.mode, optarg, len);
 				options.mode[len] = '\0';
 				break;
+			case 'w':
+				options.watch = true;
+				break;
 			case 'x':
 				options.surfaceless = true;
 				break;
+			case OPT_CACHE_DIR:
+				options.cache_dir = optarg;
+				break;
+			case OPT_NO_CACHE:
+				options.no_program_cache = true;
+				break;
+			case OPT_PRECOMPILE:
+				precompile = optarg;
+				break;
+			case OPT_PLAYLIST:
+				options.playlist = optarg;
+				break;
+			case OPT_CROSSFADE:
+				options.crossfade = strtof(optarg, NULL);
+				break;
+			case OPT_BUFFER:
+				if (num_buffers == MAX_PASS_BUFFERS) {
+					printf("at most %d buffers are supported\n", MAX_PASS_BUFFERS);
+					return -1;
+				}
+				options.buffers[num_buffers++] = optarg;
+				break;
+			case OPT_CHANNEL: {
+				unsigned channel;
+				char buffer;
+				if (sscanf(optarg, "iChannel%u=%c", &channel, &buffer) != 2 || channel >= NUM_CHANNELS) {
+					usage(argv[0]);
+					return -1;
+				}
+				options.channels[channel] = buffer;
+				break;
+			}
+			case OPT_BENCHMARK_SPECIALIZE:
+				benchmark = strtoul(optarg, NULL, 0);
+				break;
+			case OPT_PRECISION:
+				if (!strcmp(optarg, "highp")) {
+					options.precision = PRECISION_HIGHP;
+				} else if (!strcmp(optarg, "mediump")) {
+					options.precision = PRECISION_MEDIUMP;
+				} else if (!strcmp(optarg, "auto")) {
+					options.precision = PRECISION_AUTO;
+				} else {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_TARGET_FPS:
+				options.target_fps = strtof(optarg, NULL);
+				break;
+			case OPT_COMPUTE:
+				options.compute = true;
+				break;
+			case OPT_CHECKERBOARD:
+				options.checkerboard = true;
+				break;
+			case OPT_UPSCALE:
+				options.upscale = strtof(optarg, NULL);
+				for (unsigned i = 0; i < ARRAY_SIZE(upscale_modes); i++) {
+					if (!strcmp(optarg, upscale_modes[i].name)) {
+						options.upscale = 1.0f / upscale_modes[i].ratio;
+					}
+				}
+				if (options.upscale <= 0 || options.upscale >= 1) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_RENDER_RATE:
+				if (!strcmp(optarg, "auto")) {
+					options.render_rate = -1.0f;
+				} else {
+					options.render_rate = strtof(optarg, NULL);
+					if (options.render_rate <= 0) {
+						usage(argv[0]);
+						return -1;
+					}
+				}
+				break;
+			case OPT_MAX_FPS:
+				options.max_fps = strtof(optarg, NULL);
+				if (options.max_fps <= 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_VBLANK_DIVISOR:
+				options.vblank_divisor = strtoul(optarg, NULL, 0);
+				if (options.vblank_divisor < 1) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_VRR:
+				options.vrr = true;
+				break;
+			case OPT_ADAPTIVE_MODE:
+				options.adaptive_mode = true;
+				break;
+			case OPT_MAILBOX:
+				options.mailbox = true;
+				break;
+			case OPT_REALTIME:
+				if (!strcmp(optarg, "fifo")) {
+					options.scheduling = SCHEDULING_FIFO;
+				} else if (!strcmp(optarg, "deadline")) {
+					options.scheduling = SCHEDULING_DEADLINE;
+				} else {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_CPU_AFFINITY:
+				options.cpu_affinity = optarg;
+				break;
+			case OPT_THERMAL_LIMIT:
+				options.thermal_limit = strtof(optarg, NULL);
+				if (options.thermal_limit <= 0) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_SYSFS_ROOT:
+				options.sysfs_root = optarg;
+				break;
+			case OPT_BEAM_RACING:
+				options.beam_slices = strtoul(optarg, NULL, 0);
+				if (options.beam_slices < 2) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case OPT_SKIP_STATIC:
+				options.skip_static = true;
+				break;
+			case OPT_FOVEATE:
+				options.foveate = optarg;
+				break;
+			case OPT_INTERPOLATE:
+				options.interpolate = true;
+				break;
+			case OPT_TAAU:
+				options.taau = strtof(optarg, NULL);
+				if (options.taau <= 0 || options.taau >= 1) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
 			default:
 				usage(argv[0]);
 				return -1;
 		}
 	}
 
-	if (argc - optind != 1) {
-		usage(argv[0]);
-		return -1;
+	if (precompile) {
+		if (argc - optind != 0 || options.no_program_cache) {
+			usage(argv[0]);
+			return -1;
+		}
+		// Specialized programs depend on the inputs of the run
+		if (options.specialize) {
+			printf("--specialize is not supported with --precompile\n");
+			return -1;
+		}
+		if (init_display(&options) < 0) {
+			return -1;
+		}
+		return precompile_shadertoys(precompile, &options);
+	}
+
+	if (options.playlist) {
+		if (argc - optind != 0 || benchmark) {
+			usage(argv[0]);
+			return -1;
+		}
+	} else {
+		if (argc - optind != 1) {
+			usage(argv[0]);
+			return -1;
+		}
+		shadertoy = argv[optind];
 	}
-	shadertoy = argv[optind];
 
 	ret = init(shadertoy, &options);
 	if (ret < 0) {
 		return -1;
 	}
 
+	if (benchmark) {
+		return benchmark_specialization(shadertoy, benchmark);
+	}
+
 	if (perfcntr) {
-		init_perfcntrs(egl, perfcntr);
+		init_perfcntrs(egl, gbm, perfcntr);
 	}
 
 	return drm->run(gbm, egl);
@@ -137,8 +137,8 @@ class Metadata(argparse.Action):
 
 
 parser = argparse.ArgumentParser(description='Run OpenGL shaders using DRM/KMS')
-parser.add_argument('shader', metavar='FILE', type=Path, nargs=1,
-                    help='the shader file')
+parser.add_argument('shader', metavar='FILE', type=Path, nargs='?',
+                    help='the shader file, unless --playlist is given')
 parser.add_argument('--async-page-flip', action=argparse.BooleanOptionalAction,
                     help='use async page flipping')
 parser.add_argument('--atomic-drm-mode', action=argparse.BooleanOptionalAction,
@@ -151,6 +151,65 @@ parser.add_argument('--mode', metavar='MODE', type=str,
                     help='specify the video mode in the format <resolution>[-<vrefresh>]')
 parser.add_argument('-n', '--frames', metavar='N', type=int,
                     help='run for the given number of frames and exit')
+parser.add_argument('-w', '--watch', action=argparse.BooleanOptionalAction,
+                    help='reload the shader file when it changes')
+parser.add_argument('--cache-dir', metavar='DIR', type=Path,
+                    help='the program binary cache directory (default: $XDG_CACHE_HOME/kms-glsl)')
+parser.add_argument('--no-cache', '--no-program-cache', action='store_true', dest='no_program_cache',
+                    help='disable the program binary cache')
+parser.add_argument('--playlist', metavar='FILE', type=Path,
+                    help="cycle through the shaders listed in the given file, one '<shader_file> [seconds]' per line")
+parser.add_argument('--crossfade', metavar='SECS', type=float,
+                    help='crossfade between playlist shaders')
+parser.add_argument('--buffer', metavar='SPEC', type=str, action='append', dest='buffers', default=[],
+                    help='add a Buffer A-D pass, rendered before the image, '
+                         'as FILE[:format=rgba8|rgba16f][:scale=S][:iChannelN=X]...')
+parser.add_argument('--channel', metavar='iChannelN=X', type=str, action='append', dest='channels', default=[],
+                    help='bind Buffer X to iChannelN of the image pass')
+parser.add_argument('-S', '--specialize', action=argparse.BooleanOptionalAction,
+                    help='compile the built-in inputs known at startup as constants')
+parser.add_argument('-d', '--define', metavar='NAME=VALUE', type=str,
+                    action='append', dest='defines', default=[], help='override a shader #define')
+parser.add_argument('--precision', choices=['highp', 'mediump', 'auto'],
+                    help='float precision of the image pass, auto selects the fastest that renders correctly')
+parser.add_argument('--target-fps', metavar='FPS', type=float,
+                    help='switch between the shader quality levels to hold the given frame rate')
+parser.add_argument('--compute', action=argparse.BooleanOptionalAction,
+                    help='run the image pass as a compute shader (OpenGL ES 3.1)')
+parser.add_argument('--checkerboard', action=argparse.BooleanOptionalAction,
+                    help='shade half of the pixels each frame, and reconstruct the others')
+parser.add_argument('--taau', metavar='SCALE', type=float,
+                    help='render at the given scale of the resolution, and upsample temporally')
+parser.add_argument('--upscale', metavar='SCALE', type=float,
+                    help='render at the given scale of the resolution, with edge-adaptive upscaling')
+parser.add_argument('--render-rate', metavar='HZ', type=str,
+                    help='render at the given rate, or auto, and present the last render in between')
+parser.add_argument('--interpolate', action=argparse.BooleanOptionalAction,
+                    help='present a blend of the last two renders between them')
+parser.add_argument('--foveate', metavar='LAYOUT', type=str,
+                    help='render a focus region at the full resolution, and rings around it at lower ones')
+parser.add_argument('--skip-static', action=argparse.BooleanOptionalAction,
+                    help='render and present frames only when they change')
+parser.add_argument('--max-fps', metavar='FPS', type=float,
+                    help='cap the frame rate')
+parser.add_argument('--vblank-divisor', metavar='N', type=int,
+                    help='present on every Nth vblank')
+parser.add_argument('--vrr', action=argparse.BooleanOptionalAction,
+                    help='use a variable refresh rate, when the connector supports it')
+parser.add_argument('--adaptive-mode', action=argparse.BooleanOptionalAction,
+                    help='switch to the refresh rate that best fits the render rate')
+parser.add_argument('--mailbox', action=argparse.BooleanOptionalAction,
+                    help='render unthrottled, and flip to the newest completed frame on each vblank')
+parser.add_argument('--beam-racing', type=int, metavar='SLICES',
+                    help='render into the scanned out buffer, in horizontal slices ahead of the beam')
+parser.add_argument('--realtime', choices=['fifo', 'deadline'],
+                    help='run the render thread with a real-time scheduling policy')
+parser.add_argument('--cpu-affinity', metavar='CPUS', type=str,
+                    help='run the render thread on CPUS, e.g. 2,3')
+parser.add_argument('--thermal-limit', metavar='CELSIUS', type=float,
+                    help='cap the frame rate to hold the temperature below CELSIUS')
+parser.add_argument('--sysfs-root', metavar='DIR', type=str,
+                    help='read the thermal sensors from DIR, instead of /sys')
 parser.add_argument('-k', '--keyboard', metavar='UNIFORM', type=str,
                     help='add keyboard')
 parser.add_argument('--touchscreen', metavar='UNIFORM', type=str,
@@ -166,6 +225,13 @@ parser.add_argument('-v', '--volume', metavar=('UNIFORM', 'FILE'), type=str, nar
 parser.add_argument('-m', '--metadata', metavar=('<UNIFORM>.KEY', 'VALUE'), type=str, nargs=2,
                     action=Metadata, dest='metadata', default={}, help='set uniform metadata')
 args = parser.parse_args()
+if len(args.buffers) > 4:
+    parser.error('at most 4 buffers are supported')
+for channel in args.channels:
+    if not re.search(r'^iChannel[0-3]=.$', channel):
+        parser.error(f'value {channel} for option --channel must match iChannelN=X')
+if (args.shader is None) == (args.playlist is None):
+    parser.error('either a shader file or --playlist is required')
 
 for (uniform, path) in args.cubemaps:
     CubemapTexture(uniform, path)
@@ -220,7 +286,7 @@ def hot_plug_devices():
 
 Thread(target=hot_plug_devices, daemon=True).start()
 
-ret = glsl.init(bytes(args.shader[0].as_posix(), 'utf-8'), byref(options(args)))
+ret = glsl.init(bytes(args.shader.as_posix(), 'utf-8') if args.shader else None, byref(options(args)))
 if ret != 0:
     devices.close()
     exit(ret)
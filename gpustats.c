@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "common.h"
+
+/* Module to sample the GPU busy percentage and power draw from sysfs, to
+ * quantify the GPU work saved by the reduced rendering modes.  The busy
+ * percentage is exposed by amdgpu, and the power by the hwmon device of the
+ * GPU, when it has a power sensor.  Both are sampled once a second at most,
+ * with sample_gpu_stats() called on each frame.
+ */
+
+#define SAMPLE_NS NSEC_PER_SEC
+
+static struct {
+	char *busy;
+	char *power;
+	uint64_t sample_time;
+
+	/* accumulated results */
+	unsigned busy_samples;
+	double busy_total;
+	unsigned power_samples;
+	double power_total;
+} gpu_stats;
+
+static bool read_value(const char *path, double *value)
+{
+	FILE *file;
+	bool ret;
+
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	ret = fscanf(file, "%lf", value) == 1;
+	fclose(file);
+
+	return ret;
+}
+
+/* Finds the sysfs attributes of the GPU of the DRM device fd */
+void init_gpu_stats(int fd)
+{
+	static const char *power_attributes[] = {"power1_average", "power1_input"};
+	struct stat st;
+	char *device, *pattern;
+	glob_t paths;
+
+	if (fstat(fd, &st) || !S_ISCHR(st.st_mode))
+		return;
+
+	asprintf(&device, "/sys/dev/char/%u:%u/device", major(st.st_rdev), minor(st.st_rdev));
+
+	asprintf(&gpu_stats.busy, "%s/gpu_busy_percent", device);
+	if (access(gpu_stats.busy, R_OK)) {
+		free(gpu_stats.busy);
+		gpu_stats.busy = NULL;
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(power_attributes) && !gpu_stats.power; i++) {
+		asprintf(&pattern, "%s/hwmon/hwmon*/%s", device, power_attributes[i]);
+		if (!glob(pattern, 0, NULL, &paths)) {
+			gpu_stats.power = strdup(paths.gl_pathv[0]);
+			globfree(&paths);
+		}
+		free(pattern);
+	}
+
+	free(device);
+
+	if (!gpu_stats.busy && !gpu_stats.power) {
+		printf("GPU busy and power are unavailable\n");
+	}
+}
+
+void sample_gpu_stats(uint64_t time)
+{
+	double value;
+
+	if (time - gpu_stats.sample_time < SAMPLE_NS)
+		return;
+	gpu_stats.sample_time = time;
+
+	if (gpu_stats.busy && read_value(gpu_stats.busy, &value)) {
+		gpu_stats.busy_samples++;
+		gpu_stats.busy_total += value;
+	}
+
+	/* in microwatts */
+	if (gpu_stats.power && read_value(gpu_stats.power, &value)) {
+		gpu_stats.power_samples++;
+		gpu_stats.power_total += value / 1e6;
+	}
+}
+
+void dump_gpu_stats(void)
+{
+	if (gpu_stats.busy_samples) {
+		printf("GPU busy: %.1f%% over %u samples\n",
+		       gpu_stats.busy_total / gpu_stats.busy_samples, gpu_stats.busy_samples);
+	}
+	if (gpu_stats.power_samples) {
+		printf("GPU power: %.2f W over %u samples\n",
+		       gpu_stats.power_total / gpu_stats.power_samples, gpu_stats.power_samples);
+	}
+}
@@ -16,6 +16,7 @@ from threading import Thread
 _pending_inputs = collections.deque()
 _active_inputs = []
 _texture_units = iter([])
+_builtin_uniforms = {'iMouse'}
 
 
 def _init_slots():
@@ -129,6 +130,13 @@ def _drain(q: collections.deque):
 def _setup(program, width, height):
     _init_slots()
 
+    # Re-initialise the active inputs, when the program has been reloaded
+    for input in _active_inputs:
+        try:
+            input.init(program=program, width=width, height=height)
+        except Exception as e:
+            print(f"invalid {type(input).__name__} input '{input.name}': {e}")
+
     # Drain all the inputs defined during initialisation
     for input in _drain(_pending_inputs):
         _validate_input(input, program, width, height)
@@ -175,7 +183,8 @@ class Input:
 
     def init(self, program, width, height):
         self.loc = glsl.glGetUniformLocation(program, bytes(self.name, 'utf-8'))
-        if self.loc < 0:
+        # Built-in uniforms are not necessarily active uniform variables, e.g. when declared in a uniform block
+        if self.loc < 0 and self.name not in _builtin_uniforms:
             raise NoActiveUniformVariable(self.name)
 
     def render(self, frame, time):
@@ -189,6 +198,8 @@ class Texture(Input):
     def init(self, **kwargs):
         super().init(**kwargs)
 
+        if self.tex:
+            glsl.glDeleteTextures(1, pointer(self.tex))
         self.tex = c_uint()
         self.unit = next(_texture_units)
         glsl.glUniform1i(self.loc, self.unit)
@@ -424,6 +435,13 @@ class Mouse(InputDevice):
 
         self.resolution = (width, height)
 
+    def uniform4f(self, x, y, z, w):
+        if self.name == 'iMouse':
+            # iMouse is fed natively, along with the other built-in uniforms
+            glsl.setMouse(c_float(x), c_float(y), c_float(z), c_float(w))
+        else:
+            glsl.glUniform4f(self.loc, c_float(x), c_float(y), c_float(z), c_float(w))
+
 
 class ButtonMouse(Mouse):
     click = False
@@ -455,7 +473,7 @@ class ButtonMouse(Mouse):
         else:
             (z, w) = (-z, -w)
 
-        glsl.glUniform4f(self.loc, c_float(self.drag_xy[0]), c_float(self.drag_xy[1]), c_float(z), c_float(w))
+        self.uniform4f(self.drag_xy[0], self.drag_xy[1], z, w)
 
         if self.click:
             self.click = False
@@ -608,7 +626,7 @@ class TouchMouse(Mouse):
         else:
             (z, w) = (-z, -w)
 
-        glsl.glUniform4f(self.loc, c_float(self.drag_xy[0]), c_float(self.drag_xy[1]), c_float(z), c_float(w))
+        self.uniform4f(self.drag_xy[0], self.drag_xy[1], z, w)
 
         if self.touch:
             self.touch = False
@@ -722,7 +740,7 @@ class TrackMouse(Mouse):
         else:
             (z, w) = (-z, -w)
 
-        glsl.glUniform4f(self.loc, c_float(self.drag_xy[0]), c_float(self.drag_xy[1]), c_float(z), c_float(w))
+        self.uniform4f(self.drag_xy[0], self.drag_xy[1], z, w)
 
         if self.touch:
             self.touch = False
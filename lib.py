@@ -13,8 +13,38 @@ class OPTIONS(Structure):
         ("async_page_flip", c_bool),
         ("atomic_drm_mode", c_bool),
         ("surfaceless",     c_bool),
+        ("show_hud",        c_bool),
         ("vrefresh",        c_int),
         ("frames",          c_uint),
+        ("cache_dir",       c_char_p),
+        ("no_program_cache", c_bool),
+        ("watch",           c_bool),
+        ("playlist",        c_char_p),
+        ("crossfade",       c_float),
+        ("buffers",         c_char_p * 4),
+        ("channels",        c_ubyte * 4),
+        ("specialize",      c_bool),
+        ("defines",         c_char_p * 16),
+        ("precision",       c_int),
+        ("target_fps",      c_float),
+        ("compute",         c_bool),
+        ("checkerboard",    c_bool),
+        ("taau",            c_float),
+        ("upscale",         c_float),
+        ("render_rate",     c_float),
+        ("interpolate",     c_bool),
+        ("foveate",         c_char_p),
+        ("skip_static",     c_bool),
+        ("max_fps",         c_float),
+        ("vblank_divisor",  c_uint),
+        ("vrr",             c_bool),
+        ("adaptive_mode",   c_bool),
+        ("mailbox",         c_bool),
+        ("beam_slices",     c_uint),
+        ("scheduling",      c_int),
+        ("cpu_affinity",    c_char_p),
+        ("thermal_limit",   c_float),
+        ("sysfs_root",      c_char_p),
     ]
 
 
@@ -34,4 +64,62 @@ def options(args):
         c_opts.mode = (c_ubyte * 32)(*bytes(args.mode, 'utf-8'))
     if args.frames:
         c_opts.frames = c_uint(args.frames)
+    if args.cache_dir:
+        c_opts.cache_dir = bytes(args.cache_dir.as_posix(), 'utf-8')
+    if args.no_program_cache:
+        c_opts.no_program_cache = c_bool(True)
+    if args.watch:
+        c_opts.watch = c_bool(True)
+    if args.playlist:
+        c_opts.playlist = bytes(args.playlist.as_posix(), 'utf-8')
+    if args.crossfade:
+        c_opts.crossfade = c_float(args.crossfade)
+    for (i, buffer) in enumerate(args.buffers):
+        c_opts.buffers[i] = bytes(buffer, 'utf-8')
+    for channel in args.channels:
+        c_opts.channels[int(channel[8])] = ord(channel[10])
+    if args.specialize:
+        c_opts.specialize = c_bool(True)
+    for (i, define) in enumerate(args.defines[:16]):
+        c_opts.defines[i] = bytes(define, 'utf-8')
+    if args.precision:
+        c_opts.precision = c_int(['highp', 'mediump', 'auto'].index(args.precision))
+    if args.target_fps:
+        c_opts.target_fps = c_float(args.target_fps)
+    if args.compute:
+        c_opts.compute = c_bool(True)
+    if args.checkerboard:
+        c_opts.checkerboard = c_bool(True)
+    if args.taau:
+        c_opts.taau = c_float(args.taau)
+    if args.upscale:
+        c_opts.upscale = c_float(args.upscale)
+    if args.render_rate:
+        c_opts.render_rate = c_float(-1.0 if args.render_rate == 'auto' else float(args.render_rate))
+    if args.interpolate:
+        c_opts.interpolate = c_bool(True)
+    if args.foveate:
+        c_opts.foveate = c_char_p(args.foveate.encode())
+    if args.skip_static:
+        c_opts.skip_static = c_bool(True)
+    if args.max_fps:
+        c_opts.max_fps = c_float(args.max_fps)
+    if args.vblank_divisor:
+        c_opts.vblank_divisor = c_uint(args.vblank_divisor)
+    if args.vrr:
+        c_opts.vrr = c_bool(True)
+    if args.adaptive_mode:
+        c_opts.adaptive_mode = c_bool(True)
+    if args.mailbox:
+        c_opts.mailbox = c_bool(True)
+    if args.beam_racing:
+        c_opts.beam_slices = c_uint(args.beam_racing)
+    if args.realtime:
+        c_opts.scheduling = c_int(['default', 'fifo', 'deadline'].index(args.realtime))
+    if args.cpu_affinity:
+        c_opts.cpu_affinity = c_char_p(args.cpu_affinity.encode())
+    if args.thermal_limit:
+        c_opts.thermal_limit = c_float(args.thermal_limit)
+    if args.sysfs_root:
+        c_opts.sysfs_root = c_char_p(args.sysfs_root.encode())
     return c_opts
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+
+/* Module to wait on all the event sources of the run loops at once: the DRM
+ * fd, stdin, render fences, the pacing timer, and the inotify watches, are
+ * registered once on an epoll instance, and dispatched to their callbacks,
+ * so that each frame waits with a single epoll_wait().
+ *
+ * The events are dispatched on the render thread, that runs the loop.
+ */
+
+#define MAX_SOURCES 16
+#define MAX_EVENTS 8
+
+struct event_source {
+	int fd;
+	void (*callback)(int fd, void *data);
+	void *data;
+};
+
+static struct {
+	int epoll;
+	int timer;
+	bool timer_expired;
+	bool fence_signaled;
+	bool interrupted;
+	struct event_source sources[MAX_SOURCES];
+} loop = {
+		.epoll = -1,
+		.timer = -1,
+};
+
+static void timer_callback(int fd, void *data)
+{
+	uint64_t expirations;
+	(void) data;
+
+	if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+		loop.timer_expired = true;
+}
+
+static void stdin_callback(int fd, void *data)
+{
+	(void) fd, (void) data;
+
+	printf("user interrupted!\n");
+	loop.interrupted = true;
+}
+
+static void fence_callback(int fd, void *data)
+{
+	(void) fd, (void) data;
+
+	loop.fence_signaled = true;
+}
+
+int init_event_loop(void)
+{
+	if (loop.epoll >= 0)
+		return 0;
+
+	loop.epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (loop.epoll < 0) {
+		printf("failed to create epoll instance: %s\n", strerror(errno));
+		return -1;
+	}
+
+	loop.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (loop.timer < 0 || add_event_source(loop.timer, timer_callback, NULL)) {
+		printf("failed to create the pacing timer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Not pollable when redirected from a file, and then not watched */
+	if (add_event_source(STDIN_FILENO, stdin_callback, NULL)) {
+		printf("Not watching stdin for user interruption\n");
+	}
+
+	return 0;
+}
+
+int add_event_source(int fd, void (*callback)(int fd, void *data), void *data)
+{
+	struct event_source *source = NULL;
+
+	if (init_event_loop())
+		return -1;
+
+	for (unsigned i = 0; i < MAX_SOURCES; i++) {
+		if (!loop.sources[i].callback) {
+			source = &loop.sources[i];
+			break;
+		}
+	}
+	if (!source) {
+		printf("too many event sources\n");
+		return -1;
+	}
+
+	struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.ptr = source,
+	};
+	if (epoll_ctl(loop.epoll, EPOLL_CTL_ADD, fd, &event))
+		return -1;
+
+	source->fd = fd;
+	source->callback = callback;
+	source->data = data;
+
+	return 0;
+}
+
+void remove_event_source(int fd)
+{
+	for (unsigned i = 0; i < MAX_SOURCES; i++) {
+		if (loop.sources[i].callback && loop.sources[i].fd == fd) {
+			epoll_ctl(loop.epoll, EPOLL_CTL_DEL, fd, NULL);
+			loop.sources[i].callback = NULL;
+		}
+	}
+}
+
+/* Waits for events, up to timeout ms, or without blocking for 0, and
+ * dispatches them.
+ */
+int dispatch_events(int timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int count;
+
+	do {
+		count = epoll_wait(loop.epoll, events, MAX_EVENTS, timeout);
+	} while (count < 0 && errno == EINTR);
+
+	if (count < 0) {
+		printf("failed to wait for events: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct event_source *source = events[i].data.ptr;
+
+		/* removed by a previous callback */
+		if (source->callback)
+			source->callback(source->fd, source->data);
+	}
+
+	return 0;
+}
+
+/* Dispatches the events until time, on the monotonic clock, or until the
+ * user interrupts.
+ */
+int wait_events_until(uint64_t time)
+{
+	struct itimerspec spec = {
+			.it_value = {
+					.tv_sec = time / NSEC_PER_SEC,
+					.tv_nsec = time % NSEC_PER_SEC,
+			},
+	};
+
+	/* a zero time would disarm the timer */
+	if (!time)
+		return dispatch_events(0);
+
+	loop.timer_expired = false;
+	if (timerfd_settime(loop.timer, TFD_TIMER_ABSTIME, &spec, NULL)) {
+		printf("failed to arm the pacing timer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	while (!loop.timer_expired && !loop.interrupted) {
+		if (dispatch_events(-1))
+			return -1;
+	}
+
+	if (loop.timer_expired)
+		record_wakeup(time, get_time_ns());
+
+	return 0;
+}
+
+/* Dispatches the events until the fence fd signals, or until the user
+ * interrupts, and closes it.
+ */
+int wait_fence(int fd)
+{
+	int ret = 0;
+
+	loop.fence_signaled = false;
+	if (add_event_source(fd, fence_callback, NULL)) {
+		close(fd);
+		return -1;
+	}
+
+	while (!loop.fence_signaled && !loop.interrupted && !ret)
+		ret = dispatch_events(-1);
+
+	remove_event_source(fd);
+	close(fd);
+
+	return ret;
+}
+
+/* Waits for the rendering to complete, on a native fence fd when supported,
+ * for the other events to be dispatched meanwhile.
+ */
+int finish_render(const struct egl *egl)
+{
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+	int fd = -1;
+
+	if (egl->eglCreateSyncKHR && egl->eglDupNativeFenceFDANDROID) {
+		sync = egl->eglCreateSyncKHR(egl->display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+	}
+	if (sync != EGL_NO_SYNC_KHR) {
+		/* the fd is only available once the fence is flushed */
+		glFlush();
+		fd = egl->eglDupNativeFenceFDANDROID(egl->display, sync);
+		egl->eglDestroySyncKHR(egl->display, sync);
+	}
+
+	if (fd < 0) {
+		glFinish();
+		return 0;
+	}
+
+	return wait_fence(fd);
+}
+
+bool event_loop_interrupted(void)
+{
+	return loop.interrupted;
+}
@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "common.h"
+
+/* Module to decouple the shading rate from the refresh rate: the shader is
+ * only rendered on some of the vblanks, either at a fixed rate, or at an
+ * adaptive one, lowered while the render time exceeds the refresh interval.
+ * The other vblanks present the last rendered buffer again, without any GPU
+ * work, or a blend of the last two renders, when the renderer implements
+ * egl->present().
+ *
+ * Call start_pacing_frame() on each vblank, to know whether to render, and
+ * end_pacing_frame() once the rendering has completed.
+ *
+ * Independently, the frame rate can be capped, with wait_frame_cap() at the
+ * start of each frame: it sleeps until shortly before the deadline, then
+ * spins up to it, as sleeps overshoot by up to scheduler latencies.  The cap
+ * is also lowered by the thermal governor, to hold the temperature.
+ *
+ * The times between the presentations of new frames are accumulated with
+ * record_presentation(), to compare their variance across modes, e.g. with
+ * and without variable refresh rate.
+ */
+
+/* Measurement window of the adaptive rate */
+#define WINDOW_NS (NSEC_PER_SEC / 2)
+/* The rate is lowered once the render time exceeds BUDGET of the refresh
+ * intervals between renders, and raised once it fits in MARGIN of the
+ * budget at the higher rate.
+ */
+#define BUDGET 0.9
+#define MARGIN 0.75
+/* Lowest rate, as a divisor of the refresh rate */
+#define MAX_DIVISOR 8
+
+/* Bounds of the spin time of the frame cap, before the deadline, adapted to
+ * the oversleep of the system.
+ */
+#define MIN_SPIN_NS (NSEC_PER_SEC / 20000)
+#define MAX_SPIN_NS (NSEC_PER_SEC / 500)
+
+static struct {
+	bool enabled;
+	bool adaptive;
+	float refresh;
+
+	/* renders per vblank, and the progress to the next render */
+	float step;
+	float phase;
+
+	bool rendering;
+	uint64_t render_start;
+
+	/* adaptive rate, as a divisor of the refresh rate */
+	unsigned divisor;
+	uint64_t window_start;
+	uint64_t window_time;
+	unsigned window_renders;
+
+	/* accumulated results */
+	unsigned vblanks;
+	unsigned renders;
+	uint64_t render_time;
+	unsigned changes;
+} pacing;
+
+static struct {
+	uint64_t interval;
+	uint64_t deadline;
+	uint64_t spin;
+
+	/* accumulated lateness of the wake ups */
+	unsigned waits;
+	double jitter_total;
+	double jitter_squares;
+	uint64_t jitter_max;
+} cap;
+
+static struct {
+	/* refresh interval, to count the vblanks missed between frames */
+	uint64_t period;
+	uint64_t last;
+	unsigned count;
+	unsigned missed;
+	double total;
+	double squares;
+} presentation;
+
+/* Renders at rate Hz, or adaptively for a negative rate */
+void init_pacing(float rate, float refresh)
+{
+	presentation.period = refresh > 0 ? NSEC_PER_SEC / refresh : 0;
+
+	if (rate == 0 || refresh <= 0)
+		return;
+
+	pacing.enabled = true;
+	pacing.adaptive = rate < 0;
+	pacing.refresh = refresh;
+	pacing.divisor = 1;
+	pacing.step = pacing.adaptive ? 1.0f : MIN2(rate / refresh, 1.0f);
+	/* render on the first vblank */
+	pacing.phase = 1.0f - pacing.step;
+
+	if (pacing.adaptive) {
+		printf("Rendering at %.2f Hz at most, lowered to hold the render time\n", refresh);
+	} else {
+		printf("Rendering at %.2f Hz, presenting at %.2f Hz\n", pacing.step * refresh, refresh);
+	}
+}
+
+/* Follows a change of the refresh rate of the mode, e.g. with --adaptive-mode */
+void pacing_refresh_changed(float refresh)
+{
+	presentation.period = NSEC_PER_SEC / refresh;
+}
+
+/* Returns whether to render on this vblank, or to present the last render */
+bool start_pacing_frame(uint64_t time)
+{
+	if (!pacing.enabled)
+		return true;
+
+	pacing.vblanks++;
+	pacing.phase += pacing.step;
+
+	/* with some slack, for the rounding of the step */
+	pacing.rendering = pacing.phase >= 1.0f - 1e-4f;
+	if (pacing.rendering) {
+		pacing.phase = MAX2(pacing.phase - 1.0f, 0.0f);
+		pacing.render_start = time;
+	}
+
+	return pacing.rendering;
+}
+
+/* Progress from the last render to the next one, in [0, 1) */
+float pacing_progress(void)
+{
+	return pacing.enabled ? MIN2(pacing.phase, 1.0f) : 0.0f;
+}
+
+static void adapt_rate(uint64_t time)
+{
+	double interval = NSEC_PER_SEC / pacing.refresh;
+	double average;
+
+	if (!pacing.window_start) {
+		pacing.window_start = time;
+	}
+
+	if (time - pacing.window_start < WINDOW_NS || !pacing.window_renders)
+		return;
+
+	average = pacing.window_time / (double) pacing.window_renders;
+	pacing.window_start = time;
+	pacing.window_time = 0;
+	pacing.window_renders = 0;
+
+	if (average > BUDGET * interval * pacing.divisor && pacing.divisor < MAX_DIVISOR) {
+		pacing.divisor++;
+	} else if (pacing.divisor > 1 && average < MARGIN * BUDGET * interval * (pacing.divisor - 1)) {
+		pacing.divisor--;
+	} else {
+		return;
+	}
+
+	pacing.step = 1.0f / pacing.divisor;
+	pacing.changes++;
+	printf("Rendering at %.2f Hz, for %.3f ms/render\n",
+	       pacing.refresh / pacing.divisor, average / (NSEC_PER_SEC / MSEC_PER_SEC));
+}
+
+/* Accounts for the render started on this vblank, completed at time */
+void end_pacing_frame(uint64_t time)
+{
+	if (!pacing.enabled || !pacing.rendering)
+		return;
+
+	pacing.renders++;
+	pacing.render_time += time - pacing.render_start;
+
+	if (pacing.adaptive) {
+		pacing.window_renders++;
+		pacing.window_time += time - pacing.render_start;
+		adapt_rate(time);
+	}
+}
+
+void init_frame_cap(float max_fps)
+{
+	if (max_fps <= 0)
+		return;
+
+	cap.interval = NSEC_PER_SEC / max_fps;
+	cap.spin = MAX_SPIN_NS;
+
+	printf("Capping the frame rate at %.2f fps\n", max_fps);
+}
+
+/* Waits for the start of the next frame, under the frame rate cap */
+void wait_frame_cap(void)
+{
+	uint64_t time, wake;
+	float max_fps;
+
+	if (thermal_frame_cap(&max_fps)) {
+		cap.interval = max_fps > 0 ? NSEC_PER_SEC / max_fps : 0;
+		cap.deadline = 0;
+		if (!cap.spin)
+			cap.spin = MAX_SPIN_NS;
+	}
+
+	if (!cap.interval)
+		return;
+
+	time = get_time_ns();
+
+	/* No waiting, nor catching up, after late frames */
+	if (!cap.deadline || time > cap.deadline + cap.interval) {
+		cap.deadline = time + cap.interval;
+		return;
+	}
+
+	if (time < cap.deadline) {
+		if (cap.deadline - time > cap.spin) {
+			wake = cap.deadline - cap.spin;
+			struct timespec ts = {
+					.tv_sec = wake / NSEC_PER_SEC,
+					.tv_nsec = wake % NSEC_PER_SEC,
+			};
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+			/* Spin for twice the last oversleep, within bounds */
+			time = get_time_ns();
+			cap.spin = MIN2(MAX2(2 * (time > wake ? time - wake : 0), MIN_SPIN_NS), MAX_SPIN_NS);
+		}
+
+		while ((time = get_time_ns()) < cap.deadline)
+			;
+
+		cap.waits++;
+		cap.jitter_total += time - cap.deadline;
+		cap.jitter_squares += (double) (time - cap.deadline) * (time - cap.deadline);
+		cap.jitter_max = MAX2(cap.jitter_max, time - cap.deadline);
+	}
+
+	cap.deadline += cap.interval;
+}
+
+/* Accounts for a new frame, presented at time */
+void record_presentation(uint64_t time)
+{
+	if (presentation.last && time > presentation.last) {
+		double interval = time - presentation.last;
+
+		presentation.count++;
+		presentation.total += interval;
+		presentation.squares += interval * interval;
+
+		/* with half a refresh interval of slack, for the VRR range */
+		if (presentation.period && interval > 1.5 * presentation.period)
+			presentation.missed += (unsigned) (interval / presentation.period + 0.5) - 1;
+	}
+	presentation.last = time;
+}
+
+void dump_pacing(void)
+{
+	if (cap.waits) {
+		double mean = cap.jitter_total / cap.waits;
+		double variance = cap.jitter_squares / cap.waits - mean * mean;
+
+		printf("Frame cap wake-up jitter: %.1f us mean, %.1f us stddev, %.1f us max over %u waits\n",
+		       mean / 1000.0, sqrt(MAX2(variance, 0.0)) / 1000.0, cap.jitter_max / 1000.0, cap.waits);
+	}
+
+	if (presentation.count) {
+		double mean = presentation.total / presentation.count;
+		double variance = presentation.squares / presentation.count - mean * mean;
+
+		printf("Frame times: %.3f ms mean, %.3f ms stddev over %u frames, %u vblanks missed\n",
+		       mean / 1e6, sqrt(MAX2(variance, 0.0)) / 1e6, presentation.count, presentation.missed);
+	}
+
+	if (!pacing.enabled || !pacing.vblanks)
+		return;
+
+	printf("Rendered %u of %u vblanks (%.1f%%), %.3f ms/render\n",
+	       pacing.renders, pacing.vblanks, 100.0 * pacing.renders / pacing.vblanks,
+	       pacing.renders ? pacing.render_time / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / pacing.renders : 0);
+	if (pacing.adaptive) {
+		printf("  rate changed %u times, last at %.2f Hz\n",
+		       pacing.changes, pacing.refresh / pacing.divisor);
+	}
+}
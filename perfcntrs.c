@@ -35,13 +35,22 @@
 #include "common.h"
 
 /* Module to collect a specified set of performance counts, and accumulate
- * results, using the GL_AMD_performance_monitor extension.
+ * results, using either the GL_AMD_performance_monitor or the
+ * GL_INTEL_performance_query extension, whichever the driver exposes.
  *
  * Call start_perfcntrs() before the draw(s) to measure, and end_perfcntrs()
  * after the last draw to measure.  This can be done multiple times, with
  * the results accumulated.
+ *
+ * On top of the raw counters, derived metrics can be computed from the
+ * accumulated results, with simple arithmetic expressions, and named
+ * presets expand to the relevant counters and metrics for the GPU family.
  */
 
+#ifndef GL_DOUBLE
+#define GL_DOUBLE 0x140A
+#endif
+
 /**
  * Accumulated counter result:
  */
@@ -49,6 +58,7 @@ union counter_result {
 	uint32_t u32;   /* GL_UNSIGNED_INT */
 	float    f;     /* GL_FLOAT, GL_PERCENTAGE_AMD */
 	uint64_t u64;   /* GL_UNSIGNED_INT64_AMD */
+	double   d;     /* GL_DOUBLE */
 };
 
 /**
@@ -64,6 +74,36 @@ struct counter {
 	unsigned cidx;
 };
 
+/**
+ * Derived metric expression tree:
+ */
+enum expr_op {
+	EXPR_NUMBER,
+	EXPR_COUNTER,
+	EXPR_FRAMES,
+	EXPR_PIXELS,
+	EXPR_SECS,
+	EXPR_NEG,
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_MUL,
+	EXPR_DIV,
+};
+
+struct expr {
+	enum expr_op op;
+	double number;      /* EXPR_NUMBER */
+	unsigned counter;   /* EXPR_COUNTER, index into perfcntr.counters */
+	unsigned gidx;      /* EXPR_COUNTER, as looked up before it is tracked */
+	unsigned cidx;
+	struct expr *lhs, *rhs;
+};
+
+struct metric {
+	char *name;
+	struct expr *expr;
+};
+
 /**
  * Description of gl counter groups and counters:
  */
@@ -71,7 +111,12 @@ struct counter {
 struct gl_counter {
 	char *name;
 	GLuint counter_id;
+	/* one of GL_UNSIGNED_INT, GL_FLOAT, GL_UNSIGNED_INT64_AMD,
+	 * GL_PERCENTAGE_AMD or GL_DOUBLE, whatever the backend:
+	 */
 	GLuint counter_type;
+	/* INTEL_performance_query only, location in the query data: */
+	GLuint offset;
 	struct counter *counter;  /* NULL if this is not a counter we track */
 };
 
@@ -82,23 +127,46 @@ struct gl_counter_group {
 	GLint num_counters;
 	struct gl_counter *counters;
 
+	/* INTEL_performance_query only, size of the query data: */
+	GLuint data_size;
+
 	/* number of counters in this group which are enabled: */
 	int num_enabled_counters;
 };
 
 struct gl_monitor {
+	/* AMD_performance_monitor monitor, or INTEL_performance_query
+	 * query handles, one per group with enabled counters:
+	 */
 	GLuint id;
+	GLuint *handles;
 	bool valid;
 	bool active;
 };
 
+/**
+ * Performance counter extension backend.  A backend describes the
+ * available counters into perfcntr.groups, and implements the monitor
+ * life-cycle, accumulating results into the tracked counters.
+ */
+struct perfcntr_backend {
+	const char *name;
+	bool (*supported)(const struct egl *egl);
+	void (*get_groups_and_counters)(const struct egl *egl);
+	void (*init_monitor)(struct gl_monitor *m);
+	void (*begin_monitor)(struct gl_monitor *m);
+	void (*end_monitor)(struct gl_monitor *m);
+	void (*finish_monitor)(struct gl_monitor *m);
+};
+
 /**
  * module state
  */
 static struct {
 	const struct egl *egl;
+	const struct perfcntr_backend *backend;
 
-	/* The extension doesn't let us pause/resume a single counter, so
+	/* The extensions don't let us pause/resume a single counter, so
 	 * instead use a sequence of monitors, one per start_perfcntrs()/
 	 * end_perfcntrs() pair, so that we don't need to immediately read
 	 * back a result, which could cause a stall.
@@ -111,6 +179,14 @@ static struct {
 	unsigned num_counters;
 	struct counter *counters;
 
+	/* The derived metrics, computed from the counters on dump:
+	 */
+	unsigned num_metrics;
+	struct metric *metrics;
+
+	/* number of pixels shaded per frame: */
+	uint64_t pixels;
+
 	/* The description of all counter groups and the counters they
 	 * contain, not just including the ones we monitor.
 	 */
@@ -119,7 +195,49 @@ static struct {
 
 } perfcntr;
 
-static void get_groups_and_counters(const struct egl *egl)
+static void accumulate_counter(struct gl_counter *c, const void *data)
+{
+	switch(c->counter_type) {
+	case GL_UNSIGNED_INT:
+		c->counter->result.u32 += *(uint32_t *)data;
+		break;
+	case GL_FLOAT:
+	case GL_PERCENTAGE_AMD:
+		c->counter->result.f += *(float *)data;
+		break;
+	case GL_UNSIGNED_INT64_AMD:
+		c->counter->result.u64 += *(uint64_t *)data;
+		break;
+	case GL_DOUBLE:
+		c->counter->result.d += *(double *)data;
+		break;
+	default:
+		errx(-1, "TODO unhandled counter type: 0x%04x",
+			c->counter_type);
+		break;
+	}
+}
+
+/*
+ * GL_AMD_performance_monitor backend
+ */
+
+static bool amd_supported(const struct egl *egl)
+{
+	return egl->glGetPerfMonitorGroupsAMD &&
+	       egl->glGetPerfMonitorCountersAMD &&
+	       egl->glGetPerfMonitorGroupStringAMD &&
+	       egl->glGetPerfMonitorCounterStringAMD &&
+	       egl->glGetPerfMonitorCounterInfoAMD &&
+	       egl->glGenPerfMonitorsAMD &&
+	       egl->glDeletePerfMonitorsAMD &&
+	       egl->glSelectPerfMonitorCountersAMD &&
+	       egl->glBeginPerfMonitorAMD &&
+	       egl->glEndPerfMonitorAMD &&
+	       egl->glGetPerfMonitorCounterDataAMD;
+}
+
+static void amd_get_groups_and_counters(const struct egl *egl)
 {
 	int n;
 
@@ -171,101 +289,209 @@ static void get_groups_and_counters(const struct egl *egl)
 	}
 }
 
-static void find_counter(const char *name, unsigned *group_idx, unsigned *counter_idx)
+/* Create perf-monitor, and configure the counters it will monitor */
+static void amd_init_monitor(struct gl_monitor *m)
 {
+	const struct egl *egl = perfcntr.egl;
+
+	egl->glGenPerfMonitorsAMD(1, &m->id);
+
 	for (int i = 0; i < perfcntr.num_groups; i++) {
 		struct gl_counter_group *g = &perfcntr.groups[i];
 
+		if (!g->num_enabled_counters)
+			continue;
+
+		int idx = 0;
+		GLuint counters[g->num_enabled_counters];
+
 		for (int j = 0; j < g->num_counters; j++) {
 			struct gl_counter *c = &g->counters[j];
 
-			if (strcmp(name, c->name) == 0) {
-				*group_idx = i;
-				*counter_idx = j;
-				return;
-			}
+			if (!c->counter)
+				continue;
+
+			assert(idx < g->num_enabled_counters);
+			counters[idx++] = c->counter_id;
 		}
+
+		assert(idx == g->num_enabled_counters);
+		egl->glSelectPerfMonitorCountersAMD(m->id, GL_TRUE,
+			g->group_id, g->num_enabled_counters, counters);
 	}
+}
 
-	errx(-1, "Could not find counter: %s", name);
+static void amd_begin_monitor(struct gl_monitor *m)
+{
+	perfcntr.egl->glBeginPerfMonitorAMD(m->id);
 }
 
-static void add_counter(const char *name)
+static void amd_end_monitor(struct gl_monitor *m)
 {
-	int idx = perfcntr.num_counters++;
+	perfcntr.egl->glEndPerfMonitorAMD(m->id);
+}
 
-	perfcntr.counters = realloc(perfcntr.counters,
-		perfcntr.num_counters * sizeof(struct counter));
+static struct gl_counter *lookup_counter(GLuint group_id, GLuint counter_id)
+{
+	for (int i = 0; i < perfcntr.num_groups; i++) {
+		struct gl_counter_group *g = &perfcntr.groups[i];
 
-	struct counter *c = &perfcntr.counters[idx];
-	memset(c, 0, sizeof(*c));
+		if (g->group_id != group_id)
+			continue;
+
+		for (int j = 0; j < g->num_counters; j++) {
+			struct gl_counter *c = &g->counters[j];
 
-	find_counter(name, &c->gidx, &c->cidx);
+			if (c->counter_id != counter_id)
+				continue;
 
-	struct gl_counter_group *g = &perfcntr.groups[c->gidx];
-	if (g->num_enabled_counters >= g->max_active_counters) {
-		errx(-1, "Too many counters in group '%s'", g->name);
+			return c;
+		}
 	}
 
-	g->num_enabled_counters++;
+	errx(-1, "invalid counter: group_id=%u, counter_id=%u",
+		group_id, counter_id);
 }
 
-/* parse list of performance counter names, and find their group+counter */
-static void find_counters(const char *perfcntrs)
+/* Collect monitor results and delete monitor */
+static void amd_finish_monitor(struct gl_monitor *m)
 {
-	char *cnames, *s;
+	const struct egl *egl = perfcntr.egl;
 
-	cnames = strdup(perfcntrs);
-	while ((s = strstr(cnames, ","))) {
-		char *name = cnames;
-		s[0] = '\0';
-		cnames = &s[1];
+	GLuint result_size;
+	egl->glGetPerfMonitorCounterDataAMD(m->id, GL_PERFMON_RESULT_SIZE_AMD,
+		sizeof(GLint), &result_size, NULL);
+
+	GLuint *data = malloc(result_size);
+
+	GLsizei bytes_written;
+	egl->glGetPerfMonitorCounterDataAMD(m->id, GL_PERFMON_RESULT_AMD,
+			result_size, data, &bytes_written);
+
+	GLsizei idx = 0;
+	while ((4 * idx) < bytes_written) {
+		GLuint group_id = data[idx++];
+		GLuint counter_id = data[idx++];
 
-		add_counter(name);
+		struct gl_counter *c = lookup_counter(group_id, counter_id);
+
+		assert(c->counter);
+
+		accumulate_counter(c, &data[idx]);
+		idx += c->counter_type == GL_UNSIGNED_INT64_AMD ? 2 : 1;
 	}
 
-	add_counter(cnames);
+	free(data);
+
+	egl->glDeletePerfMonitorsAMD(1, &m->id);
 }
 
-void init_perfcntrs(const struct egl *egl, const char *perfcntrs)
+static const struct perfcntr_backend amd_backend = {
+	.name = "AMD_performance_monitor",
+	.supported = amd_supported,
+	.get_groups_and_counters = amd_get_groups_and_counters,
+	.init_monitor = amd_init_monitor,
+	.begin_monitor = amd_begin_monitor,
+	.end_monitor = amd_end_monitor,
+	.finish_monitor = amd_finish_monitor,
+};
+
+/*
+ * GL_INTEL_performance_query backend
+ *
+ * Queries map to counter groups.  A query collects all of its counters
+ * at once, so there is no per-counter selection, and a monitor slot
+ * holds one query handle per group with enabled counters.
+ */
+
+static bool intel_supported(const struct egl *egl)
 {
-	if (egl_check(egl, glGetPerfMonitorGroupsAMD) ||
-	    egl_check(egl, glGetPerfMonitorCountersAMD) ||
-	    egl_check(egl, glGetPerfMonitorGroupStringAMD) ||
-	    egl_check(egl, glGetPerfMonitorCounterStringAMD) ||
-	    egl_check(egl, glGetPerfMonitorCounterInfoAMD) ||
-	    egl_check(egl, glGenPerfMonitorsAMD) ||
-	    egl_check(egl, glDeletePerfMonitorsAMD) ||
-	    egl_check(egl, glSelectPerfMonitorCountersAMD) ||
-	    egl_check(egl, glBeginPerfMonitorAMD) ||
-	    egl_check(egl, glEndPerfMonitorAMD) ||
-	    egl_check(egl, glGetPerfMonitorCounterDataAMD)) {
-		errx(-1, "AMD_performance_monitor is not supported");
+	return egl->glGetFirstPerfQueryIdINTEL &&
+	       egl->glGetNextPerfQueryIdINTEL &&
+	       egl->glGetPerfQueryInfoINTEL &&
+	       egl->glGetPerfCounterInfoINTEL &&
+	       egl->glCreatePerfQueryINTEL &&
+	       egl->glDeletePerfQueryINTEL &&
+	       egl->glBeginPerfQueryINTEL &&
+	       egl->glEndPerfQueryINTEL &&
+	       egl->glGetPerfQueryDataINTEL;
+}
+
+static GLuint intel_counter_type(GLuint data_type)
+{
+	switch (data_type) {
+	case GL_PERFQUERY_COUNTER_DATA_UINT32_INTEL:
+	case GL_PERFQUERY_COUNTER_DATA_BOOL32_INTEL:
+		return GL_UNSIGNED_INT;
+	case GL_PERFQUERY_COUNTER_DATA_UINT64_INTEL:
+		return GL_UNSIGNED_INT64_AMD;
+	case GL_PERFQUERY_COUNTER_DATA_FLOAT_INTEL:
+		return GL_FLOAT;
+	case GL_PERFQUERY_COUNTER_DATA_DOUBLE_INTEL:
+		return GL_DOUBLE;
+	default:
+		errx(-1, "TODO unhandled counter data type: 0x%04x", data_type);
 	}
+}
 
-	get_groups_and_counters(egl);
-	find_counters(perfcntrs);
+static void intel_get_groups_and_counters(const struct egl *egl)
+{
+	GLuint query_id, name_max;
 
-	/* setup enabled counters.. do this after realloc() stuff,
-	 * otherwise the counter pointer may not be valid:
-	 */
-	for (unsigned i = 0; i < perfcntr.num_counters; i++) {
-		struct counter *c = &perfcntr.counters[i];
-		perfcntr.groups[c->gidx].counters[c->cidx].counter = c;
-	}
+	glGetIntegerv(GL_PERFQUERY_QUERY_NAME_LENGTH_MAX_INTEL, (GLint *)&name_max);
+	if (name_max == 0)
+		name_max = 256;
 
-	perfcntr.egl = egl;
+	egl->glGetFirstPerfQueryIdINTEL(&query_id);
+	while (query_id) {
+		struct gl_counter_group *g;
+		GLuint num_counters, num_instances, caps;
+
+		perfcntr.groups = realloc(perfcntr.groups,
+			(perfcntr.num_groups + 1) * sizeof(struct gl_counter_group));
+		g = &perfcntr.groups[perfcntr.num_groups++];
+		memset(g, 0, sizeof(*g));
+
+		g->group_id = query_id;
+		g->name = calloc(1, name_max);
+		egl->glGetPerfQueryInfoINTEL(query_id, name_max, g->name,
+			&g->data_size, &num_counters, &num_instances, &caps);
+
+		g->num_counters = num_counters;
+		g->max_active_counters = num_counters;
+		g->counters = calloc(g->num_counters, sizeof(struct gl_counter));
+
+		printf("GROUP[%u]: name=%s, max_active_counters=%u, num_counters=%u\n",
+			g->group_id, g->name, g->max_active_counters, g->num_counters);
+
+		for (int j = 0; j < g->num_counters; j++) {
+			struct gl_counter *c = &g->counters[j];
+			GLuint data_size, type, data_type;
+			GLuint64 raw_max;
+			char desc[1];
+
+			/* counter ids are 1-based: */
+			c->counter_id = j + 1;
+			c->name = calloc(1, name_max);
+			egl->glGetPerfCounterInfoINTEL(query_id, c->counter_id,
+				name_max, c->name, sizeof(desc), desc,
+				&c->offset, &data_size, &type, &data_type, &raw_max);
+			c->counter_type = intel_counter_type(data_type);
+
+			printf("\tCOUNTER[%u]: name=%s, counter_type=%04x\n",
+				c->counter_id, c->name, c->counter_type);
+		}
+
+		egl->glGetNextPerfQueryIdINTEL(query_id, &query_id);
+	}
 }
 
-/* Create perf-monitor, and configure the counters it will monitor */
-static void init_monitor(struct gl_monitor *m)
+static void intel_init_monitor(struct gl_monitor *m)
 {
 	const struct egl *egl = perfcntr.egl;
 
-	assert(!m->valid);
-	assert(!m->active);
-
-	egl->glGenPerfMonitorsAMD(1, &m->id);
+	if (!m->handles)
+		m->handles = calloc(perfcntr.num_groups, sizeof(GLuint));
 
 	for (int i = 0; i < perfcntr.num_groups; i++) {
 		struct gl_counter_group *g = &perfcntr.groups[i];
@@ -273,106 +499,612 @@ static void init_monitor(struct gl_monitor *m)
 		if (!g->num_enabled_counters)
 			continue;
 
-		int idx = 0;
-		GLuint counters[g->num_enabled_counters];
+		egl->glCreatePerfQueryINTEL(g->group_id, &m->handles[i]);
+		if (!m->handles[i])
+			errx(-1, "Failed to create query '%s'", g->name);
+	}
+}
 
-		for (int j = 0; j < g->num_counters; j++) {
-			struct gl_counter *c = &g->counters[j];
+static void intel_begin_monitor(struct gl_monitor *m)
+{
+	for (int i = 0; i < perfcntr.num_groups; i++) {
+		if (m->handles[i])
+			perfcntr.egl->glBeginPerfQueryINTEL(m->handles[i]);
+	}
+}
 
-			if (!c->counter)
-				continue;
+static void intel_end_monitor(struct gl_monitor *m)
+{
+	for (int i = 0; i < perfcntr.num_groups; i++) {
+		if (m->handles[i])
+			perfcntr.egl->glEndPerfQueryINTEL(m->handles[i]);
+	}
+}
 
-			assert(idx < g->num_enabled_counters);
-			counters[idx++] = c->counter_id;
+static void intel_finish_monitor(struct gl_monitor *m)
+{
+	const struct egl *egl = perfcntr.egl;
+
+	for (int i = 0; i < perfcntr.num_groups; i++) {
+		struct gl_counter_group *g = &perfcntr.groups[i];
+
+		if (!m->handles[i])
+			continue;
+
+		GLuint bytes_written = 0;
+		uint8_t *data = malloc(g->data_size);
+
+		egl->glGetPerfQueryDataINTEL(m->handles[i], GL_PERFQUERY_WAIT_INTEL,
+			g->data_size, data, &bytes_written);
+
+		if (bytes_written) {
+			for (int j = 0; j < g->num_counters; j++) {
+				struct gl_counter *c = &g->counters[j];
+
+				if (c->counter)
+					accumulate_counter(c, &data[c->offset]);
+			}
 		}
 
-		assert(idx == g->num_enabled_counters);
-		egl->glSelectPerfMonitorCountersAMD(m->id, GL_TRUE,
-			g->group_id, g->num_enabled_counters, counters);
+		free(data);
+
+		egl->glDeletePerfQueryINTEL(m->handles[i]);
+		m->handles[i] = 0;
 	}
+}
 
-	m->valid = true;
+static const struct perfcntr_backend intel_backend = {
+	.name = "INTEL_performance_query",
+	.supported = intel_supported,
+	.get_groups_and_counters = intel_get_groups_and_counters,
+	.init_monitor = intel_init_monitor,
+	.begin_monitor = intel_begin_monitor,
+	.end_monitor = intel_end_monitor,
+	.finish_monitor = intel_finish_monitor,
+};
+
+static const struct perfcntr_backend *backends[] = {
+	&amd_backend,
+	&intel_backend,
+};
+
+/*
+ * Backend agnostic counter selection and accumulation
+ */
+
+static bool match_group(const struct gl_counter_group *g, const char *name, size_t len)
+{
+	return strlen(g->name) == len && strncmp(g->name, name, len) == 0;
 }
 
-static struct gl_counter *lookup_counter(GLuint group_id, GLuint counter_id)
+/* Counter names are not necessarily unique across groups, e.g. INTEL
+ * queries share some counters, so the name can be qualified with the
+ * group name, as in "GROUP/COUNTER".  Otherwise, prefer a group that
+ * already has enabled counters, so as few groups as possible are
+ * sampled.
+ */
+static bool find_counter(const char *name, unsigned *group_idx, unsigned *counter_idx)
 {
+	const char *group = NULL;
+	size_t group_len = 0;
+	bool found = false;
+
+	const char *sep = strrchr(name, '/');
+	if (sep) {
+		group = name;
+		group_len = sep - name;
+		name = sep + 1;
+	}
+
 	for (int i = 0; i < perfcntr.num_groups; i++) {
 		struct gl_counter_group *g = &perfcntr.groups[i];
 
-		if (g->group_id != group_id)
+		if (group && !match_group(g, group, group_len))
 			continue;
 
 		for (int j = 0; j < g->num_counters; j++) {
 			struct gl_counter *c = &g->counters[j];
 
-			if (c->counter_id != counter_id)
+			if (strcmp(name, c->name) != 0)
 				continue;
 
-			return c;
+			if (!found || g->num_enabled_counters > 0) {
+				*group_idx = i;
+				*counter_idx = j;
+			}
+			if (g->num_enabled_counters > 0)
+				return true;
+			found = true;
 		}
 	}
 
-	errx(-1, "invalid counter: group_id=%u, counter_id=%u",
-		group_id, counter_id);
+	return found;
 }
 
-/* Collect monitor results and delete monitor */
-static void finish_monitor(struct gl_monitor *m)
+/* Start tracking the counter if it isn't already.  Returns the index into
+ * perfcntr.counters, or -1 if its group has no free slot left.
+ */
+static int enable_counter(unsigned gidx, unsigned cidx)
 {
-	const struct egl *egl = perfcntr.egl;
+	for (unsigned i = 0; i < perfcntr.num_counters; i++) {
+		struct counter *c = &perfcntr.counters[i];
+		if (c->gidx == gidx && c->cidx == cidx)
+			return i;
+	}
 
-	assert(m->valid);
-	assert(!m->active);
+	struct gl_counter_group *g = &perfcntr.groups[gidx];
+	if (g->num_enabled_counters >= g->max_active_counters)
+		return -1;
 
-	GLuint result_size;
-	egl->glGetPerfMonitorCounterDataAMD(m->id, GL_PERFMON_RESULT_SIZE_AMD,
-		sizeof(GLint), &result_size, NULL);
+	g->num_enabled_counters++;
 
-	GLuint *data = malloc(result_size);
+	int idx = perfcntr.num_counters++;
 
-	GLsizei bytes_written;
-	egl->glGetPerfMonitorCounterDataAMD(m->id, GL_PERFMON_RESULT_AMD,
-			result_size, data, &bytes_written);
+	perfcntr.counters = realloc(perfcntr.counters,
+		perfcntr.num_counters * sizeof(struct counter));
 
-	GLsizei idx = 0;
-	while ((4 * idx) < bytes_written) {
-		GLuint group_id = data[idx++];
-		GLuint counter_id = data[idx++];
+	struct counter *c = &perfcntr.counters[idx];
+	memset(c, 0, sizeof(*c));
+	c->gidx = gidx;
+	c->cidx = cidx;
 
-		struct gl_counter *c = lookup_counter(group_id, counter_id);
+	return idx;
+}
 
-		assert(c->counter);
+/* Find the requested counter, and start tracking it.  Returns the index
+ * into perfcntr.counters, or -1 if the counter does not exist or its group
+ * is full, and it is optional, as the counters of presets are.
+ */
+static int add_counter(const char *name, bool optional)
+{
+	unsigned gidx, cidx;
 
-		switch(c->counter_type) {
-		case GL_UNSIGNED_INT:
-			c->counter->result.u32 += *(uint32_t *)(&data[idx]);
-			idx += 1;
-			break;
-		case GL_FLOAT:
-			c->counter->result.f += *(float *)(&data[idx]);
-			idx += 1;
-			break;
-		case GL_UNSIGNED_INT64_AMD:
-			c->counter->result.u64 += *(uint64_t *)(&data[idx]);
-			idx += 2;
-			break;
-		case GL_PERCENTAGE_AMD:
-		default:
-			errx(-1, "TODO unhandled counter type: 0x%04x",
-				c->counter_type);
+	if (!find_counter(name, &gidx, &cidx)) {
+		if (optional) {
+			printf("Skipping unavailable counter: %s\n", name);
+			return -1;
+		}
+		errx(-1, "Could not find counter: %s", name);
+	}
+
+	int idx = enable_counter(gidx, cidx);
+	if (idx < 0) {
+		const char *group = perfcntr.groups[gidx].name;
+
+		if (optional) {
+			printf("Skipping counter of full group '%s': %s\n", group, name);
+			return -1;
+		}
+		errx(-1, "Too many counters in group '%s'", group);
+	}
+
+	return idx;
+}
+
+/*
+ * Derived metrics expressions, with the following grammar:
+ *
+ *   expr   := term { ('+' | '-') term }
+ *   term   := factor { ('*' | '/') factor }
+ *   factor := NUMBER | IDENT | '{' NAME '}' | '(' expr ')' | '-' factor
+ *
+ * where IDENT is either one of the built-in 'frames', 'pixels' (per frame)
+ * and 'secs' variables, or a counter name.  Counter names that contain
+ * characters other than alphanumerics, '_' and '.', like INTEL counters,
+ * or that are qualified with their group, must be enclosed in braces,
+ * e.g. '{EU Active}' or '{GROUP/COUNTER}'.
+ */
+
+struct parser {
+	const char *str;
+	const char *pos;
+	/* skip, rather than fail on, unavailable counters: */
+	bool optional;
+	bool unavailable;
+};
+
+static struct expr *parse_expr(struct parser *p);
+
+static struct expr *new_expr(enum expr_op op, struct expr *lhs, struct expr *rhs)
+{
+	struct expr *e = calloc(1, sizeof(*e));
+	e->op = op;
+	e->lhs = lhs;
+	e->rhs = rhs;
+	return e;
+}
+
+static void free_expr(struct expr *e)
+{
+	if (!e)
+		return;
+	free_expr(e->lhs);
+	free_expr(e->rhs);
+	free(e);
+}
+
+static void skip_spaces(struct parser *p)
+{
+	while (*p->pos == ' ' || *p->pos == '\t')
+		p->pos++;
+}
+
+static bool is_ident_char(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	       (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+static struct expr *parse_counter(struct parser *p, const char *name, size_t len)
+{
+	struct expr *e;
+	char *ident = strndup(name, len);
+
+	if (strcmp(ident, "frames") == 0) {
+		e = new_expr(EXPR_FRAMES, NULL, NULL);
+	} else if (strcmp(ident, "pixels") == 0) {
+		e = new_expr(EXPR_PIXELS, NULL, NULL);
+	} else if (strcmp(ident, "secs") == 0) {
+		e = new_expr(EXPR_SECS, NULL, NULL);
+	} else {
+		/* only looked up, the counters are tracked once the whole
+		 * expression is parsed:
+		 */
+		e = new_expr(EXPR_COUNTER, NULL, NULL);
+		if (!find_counter(ident, &e->gidx, &e->cidx)) {
+			if (!p->optional)
+				errx(-1, "Could not find counter: %s", ident);
+			printf("Skipping unavailable counter: %s\n", ident);
+			p->unavailable = true;
+		}
+	}
+
+	free(ident);
+	return e;
+}
+
+static struct expr *parse_factor(struct parser *p)
+{
+	struct expr *e;
+
+	skip_spaces(p);
+
+	if (*p->pos == '(') {
+		p->pos++;
+		e = parse_expr(p);
+		skip_spaces(p);
+		if (*p->pos != ')')
+			errx(-1, "Expected ')' at '%s' in: %s", p->pos, p->str);
+		p->pos++;
+	} else if (*p->pos == '-') {
+		p->pos++;
+		e = new_expr(EXPR_NEG, parse_factor(p), NULL);
+	} else if (*p->pos == '{') {
+		const char *end = strchr(++p->pos, '}');
+		if (!end)
+			errx(-1, "Expected '}' in: %s", p->str);
+		e = parse_counter(p, p->pos, end - p->pos);
+		p->pos = end + 1;
+	} else if ((*p->pos >= '0' && *p->pos <= '9') || *p->pos == '.') {
+		char *end;
+		e = new_expr(EXPR_NUMBER, NULL, NULL);
+		e->number = strtod(p->pos, &end);
+		p->pos = end;
+	} else if (is_ident_char(*p->pos)) {
+		const char *start = p->pos;
+		while (is_ident_char(*p->pos))
+			p->pos++;
+		e = parse_counter(p, start, p->pos - start);
+	} else {
+		errx(-1, "Unexpected character at '%s' in: %s", p->pos, p->str);
+	}
+
+	return e;
+}
+
+static struct expr *parse_term(struct parser *p)
+{
+	struct expr *e = parse_factor(p);
+
+	for (;;) {
+		skip_spaces(p);
+		if (*p->pos == '*') {
+			p->pos++;
+			e = new_expr(EXPR_MUL, e, parse_factor(p));
+		} else if (*p->pos == '/') {
+			p->pos++;
+			e = new_expr(EXPR_DIV, e, parse_factor(p));
+		} else {
+			return e;
+		}
+	}
+}
+
+static struct expr *parse_expr(struct parser *p)
+{
+	struct expr *e = parse_term(p);
+
+	for (;;) {
+		skip_spaces(p);
+		if (*p->pos == '+') {
+			p->pos++;
+			e = new_expr(EXPR_ADD, e, parse_term(p));
+		} else if (*p->pos == '-') {
+			p->pos++;
+			e = new_expr(EXPR_SUB, e, parse_term(p));
+		} else {
+			return e;
+		}
+	}
+}
+
+/* Start tracking the counters of the expression, returns false as soon as
+ * one of their groups is full.
+ */
+static bool enable_counters(struct expr *e)
+{
+	if (!e)
+		return true;
+
+	if (e->op == EXPR_COUNTER) {
+		int idx = enable_counter(e->gidx, e->cidx);
+		if (idx < 0)
+			return false;
+		e->counter = idx;
+		return true;
+	}
+
+	return enable_counters(e->lhs) && enable_counters(e->rhs);
+}
+
+static void add_metric(const char *name, const char *expression, bool optional)
+{
+	struct parser p = {
+		.str = expression,
+		.pos = expression,
+		.optional = optional,
+	};
+
+	struct expr *e = parse_expr(&p);
+	skip_spaces(&p);
+	if (*p.pos != '\0')
+		errx(-1, "Unexpected character at '%s' in: %s", p.pos, expression);
+
+	if (p.unavailable) {
+		printf("Skipping metric with unavailable counters: %s\n", name);
+		free_expr(e);
+		return;
+	}
+
+	/* All or none of the counters of the metric are tracked: */
+	unsigned num_counters = perfcntr.num_counters;
+	if (!enable_counters(e)) {
+		while (perfcntr.num_counters > num_counters) {
+			struct counter *c = &perfcntr.counters[--perfcntr.num_counters];
+			perfcntr.groups[c->gidx].num_enabled_counters--;
+		}
+		if (!optional)
+			errx(-1, "Too many counters for metric: %s", name);
+		printf("Skipping metric with counters of full groups: %s\n", name);
+		free_expr(e);
+		return;
+	}
+
+	int idx = perfcntr.num_metrics++;
+
+	perfcntr.metrics = realloc(perfcntr.metrics,
+		perfcntr.num_metrics * sizeof(struct metric));
+
+	perfcntr.metrics[idx].name = strdup(name);
+	perfcntr.metrics[idx].expr = e;
+}
+
+static double counter_value(const struct counter *c)
+{
+	switch (perfcntr.groups[c->gidx].counters[c->cidx].counter_type) {
+	case GL_UNSIGNED_INT:
+		return c->result.u32;
+	case GL_FLOAT:
+	case GL_PERCENTAGE_AMD:
+		return c->result.f;
+	case GL_UNSIGNED_INT64_AMD:
+		return c->result.u64;
+	case GL_DOUBLE:
+		return c->result.d;
+	default:
+		return 0.0;
+	}
+}
+
+static double eval_expr(const struct expr *e, unsigned nframes, double secs)
+{
+	switch (e->op) {
+	case EXPR_NUMBER:
+		return e->number;
+	case EXPR_COUNTER:
+		return counter_value(&perfcntr.counters[e->counter]);
+	case EXPR_FRAMES:
+		return nframes;
+	case EXPR_PIXELS:
+		return perfcntr.pixels;
+	case EXPR_SECS:
+		return secs;
+	case EXPR_NEG:
+		return -eval_expr(e->lhs, nframes, secs);
+	case EXPR_ADD:
+		return eval_expr(e->lhs, nframes, secs) + eval_expr(e->rhs, nframes, secs);
+	case EXPR_SUB:
+		return eval_expr(e->lhs, nframes, secs) - eval_expr(e->rhs, nframes, secs);
+	case EXPR_MUL:
+		return eval_expr(e->lhs, nframes, secs) * eval_expr(e->rhs, nframes, secs);
+	case EXPR_DIV:
+		return eval_expr(e->lhs, nframes, secs) / eval_expr(e->rhs, nframes, secs);
+	}
+
+	return 0.0;
+}
+
+/**
+ * Named presets, per GPU family, matched against GL_RENDERER.  Presets
+ * are regular counter lists, except unavailable counters are skipped,
+ * along with the metrics that depend on them, as the counters exposed
+ * vary across generations of a same family.
+ */
+static const struct {
+	const char *family;
+	const char *name;
+	const char *list;
+} presets[] = {
+	/* freedreno */
+	{ "Adreno", "alu",
+	  "PERF_SP_BUSY_CYCLES,PERF_SP_ALU_WORKING_CYCLES,"
+	  "alu_utilization=PERF_SP_ALU_WORKING_CYCLES/PERF_SP_BUSY_CYCLES" },
+	{ "Adreno", "texture",
+	  "PERF_TP_L1_CACHELINE_REQUESTS,PERF_TP_L1_CACHELINE_MISSES,"
+	  "tex_hit_rate=1-PERF_TP_L1_CACHELINE_MISSES/PERF_TP_L1_CACHELINE_REQUESTS" },
+	{ "Adreno", "memory",
+	  "PERF_UCHE_VBIF_READ_BEATS_TP,PERF_UCHE_VBIF_READ_BEATS_SP,"
+	  "read_bytes_per_pixel=32*(PERF_UCHE_VBIF_READ_BEATS_TP+PERF_UCHE_VBIF_READ_BEATS_SP)/(frames*pixels)" },
+	/* Intel, OA metrics */
+	{ "Intel", "alu",
+	  "EU Active,EU Stall,"
+	  "eu_active={EU Active}/frames,eu_stall={EU Stall}/frames" },
+	{ "Intel", "texture",
+	  "Sampler Busy,Sampler Texels,Sampler Texels Misses,"
+	  "sampler_busy={Sampler Busy}/frames,"
+	  "tex_hit_rate=1-{Sampler Texels Misses}/{Sampler Texels}" },
+	{ "Intel", "memory",
+	  "GTI Read Throughput,GTI Write Throughput,"
+	  "read_throughput={GTI Read Throughput}/frames,"
+	  "write_throughput={GTI Write Throughput}/frames" },
+	/* radeonsi */
+	{ "AMD", "alu",
+	  "GPU-shaders-busy,shaders_busy={GPU-shaders-busy}/frames" },
+	{ "AMD", "texture",
+	  "GPU-ta-busy,GPU-tc-busy,"
+	  "ta_busy={GPU-ta-busy}/frames,tc_busy={GPU-tc-busy}/frames" },
+	{ "AMD", "memory",
+	  "GPU-cb-busy,GPU-db-busy,"
+	  "cb_busy={GPU-cb-busy}/frames,db_busy={GPU-db-busy}/frames" },
+};
+
+static void find_counters(const char *perfcntrs, bool optional);
+
+static void expand_preset(const char *name)
+{
+	const char *renderer = (const char *) glGetString(GL_RENDERER);
+	bool found = false;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(presets); i++) {
+		if (!strstr(renderer, presets[i].family))
+			continue;
+		if (strcmp(name, presets[i].name) == 0) {
+			find_counters(presets[i].list, true);
+			return;
+		}
+		found = true;
+	}
+
+	if (found) {
+		printf("Available presets for '%s':", renderer);
+		for (unsigned i = 0; i < ARRAY_SIZE(presets); i++) {
+			if (strstr(renderer, presets[i].family))
+				printf(" @%s", presets[i].name);
+		}
+		printf("\n");
+	}
+	errx(-1, "Unknown preset for '%s': @%s", renderer, name);
+}
+
+static void add_entry(char *entry, bool optional)
+{
+	char *eq = strchr(entry, '=');
+
+	if (entry[0] == '@') {
+		expand_preset(&entry[1]);
+	} else if (eq) {
+		eq[0] = '\0';
+		add_metric(entry, &eq[1], optional);
+	} else {
+		add_counter(entry, optional);
+	}
+}
+
+/* parse list of performance counter names, derived metrics and presets,
+ * and find their group+counter
+ */
+static void find_counters(const char *perfcntrs, bool optional)
+{
+	char *cnames, *s;
+
+	cnames = strdup(perfcntrs);
+	while ((s = strstr(cnames, ","))) {
+		char *name = cnames;
+		s[0] = '\0';
+		cnames = &s[1];
+
+		add_entry(name, optional);
+	}
+
+	add_entry(cnames, optional);
+}
+
+void init_perfcntrs(const struct egl *egl, const struct gbm *gbm, const char *perfcntrs)
+{
+	for (unsigned i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (backends[i]->supported(egl)) {
+			perfcntr.backend = backends[i];
 			break;
 		}
 	}
 
-	egl->glDeletePerfMonitorsAMD(1, &m->id);
+	if (!perfcntr.backend) {
+		errx(-1, "Neither AMD_performance_monitor nor INTEL_performance_query is supported");
+	}
+
+	printf("Using %s for performance counters\n", perfcntr.backend->name);
+
+	perfcntr.pixels = (uint64_t) gbm->width * gbm->height;
+
+	perfcntr.backend->get_groups_and_counters(egl);
+	find_counters(perfcntrs, false);
+
+	/* setup enabled counters.. do this after realloc() stuff,
+	 * otherwise the counter pointer may not be valid:
+	 */
+	for (unsigned i = 0; i < perfcntr.num_counters; i++) {
+		struct counter *c = &perfcntr.counters[i];
+		perfcntr.groups[c->gidx].counters[c->cidx].counter = c;
+	}
+
+	perfcntr.egl = egl;
+}
+
+/* Create perf-monitor, and configure the counters it will monitor */
+static void init_monitor(struct gl_monitor *m)
+{
+	assert(!m->valid);
+	assert(!m->active);
+
+	perfcntr.backend->init_monitor(m);
+
+	m->valid = true;
+}
+
+/* Collect monitor results and delete monitor */
+static void finish_monitor(struct gl_monitor *m)
+{
+	assert(m->valid);
+	assert(!m->active);
+
+	perfcntr.backend->finish_monitor(m);
+
 	m->valid = false;
 }
 
 void start_perfcntrs(void)
 {
-	const struct egl *egl = perfcntr.egl;
-
-	if (!egl) {
+	if (!perfcntr.egl) {
 		return;
 	}
 
@@ -387,15 +1119,13 @@ void start_perfcntrs(void)
 
 	init_monitor(m);
 
-	egl->glBeginPerfMonitorAMD(m->id);
+	perfcntr.backend->begin_monitor(m);
 	m->active = true;
 }
 
 void end_perfcntrs(void)
 {
-	const struct egl *egl = perfcntr.egl;
-
-	if (!egl) {
+	if (!perfcntr.egl) {
 		return;
 	}
 
@@ -405,7 +1135,7 @@ void end_perfcntrs(void)
 	assert(m->active);
 
 	/* end collection, but defer collecting results to avoid stall: */
-	egl->glEndPerfMonitorAMD(m->id);
+	perfcntr.backend->end_monitor(m);
 	m->active = false;
 
 	/* move to next slot: */
@@ -446,6 +1176,9 @@ void dump_perfcntrs(unsigned nframes, uint64_t elapsed_time_ns)
 
 		printf(",%s", perfcntr.groups[c->gidx].counters[c->cidx].name);
 	}
+	for (unsigned i = 0; i < perfcntr.num_metrics; i++) {
+		printf(",%s", perfcntr.metrics[i].name);
+	}
 	printf("\n");
 
 	/* print results: */
@@ -461,17 +1194,23 @@ void dump_perfcntrs(unsigned nframes, uint64_t elapsed_time_ns)
 			printf(",%u", c->result.u32);
 			break;
 		case GL_FLOAT:
+		case GL_PERCENTAGE_AMD:
 			printf(",%f", c->result.f);
 			break;
 		case GL_UNSIGNED_INT64_AMD:
 			printf(",%"PRIu64, c->result.u64);
 			break;
-		case GL_PERCENTAGE_AMD:
+		case GL_DOUBLE:
+			printf(",%f", c->result.d);
+			break;
 		default:
 			errx(-1, "TODO unhandled counter type: 0x%04x",
 				counter_type);
 			break;
 		}
 	}
+	for (unsigned i = 0; i < perfcntr.num_metrics; i++) {
+		printf(",%f", eval_expr(perfcntr.metrics[i].expr, nframes, secs));
+	}
 	printf("\n");
 }
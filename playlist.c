@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/* Module to cycle through a list of shaders, each shown for a given
+ * duration.  The next shader of the list is built in the background, by
+ * the compiler thread, while the current one is shown, so that switching
+ * does not stall the render loop.
+ *
+ * The playlist file has one shader per line, optionally followed by the
+ * duration in seconds it's shown for.  Relative paths are resolved against
+ * the playlist directory, and lines starting with '#' are ignored.
+ */
+
+#define DEFAULT_DURATION 30.0
+
+struct playlist_entry {
+	char *file;
+	double duration;
+
+	/* playback statistics */
+	unsigned frames;
+	uint64_t elapsed_time;
+};
+
+static struct {
+	struct playlist_entry *entries;
+	unsigned count;
+
+	unsigned current;
+	uint64_t start_time;
+	unsigned frames;
+
+	/* the entry being built in the background */
+	unsigned next;
+	struct compile_job *job;
+	bool late;
+} playlist;
+
+static char *resolve_path(const char *playlist_file, const char *file)
+{
+	const char *slash = strrchr(playlist_file, '/');
+	char *path;
+
+	if (file[0] == '/' || !slash)
+		return strdup(file);
+
+	asprintf(&path, "%.*s/%s", (int) (slash - playlist_file), playlist_file, file);
+	return path;
+}
+
+/* Load the playlist, returning the first shader file */
+const char *init_playlist(const char *file)
+{
+	char *line = NULL;
+	size_t size = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		printf("could not open playlist '%s': %s\n", file, strerror(errno));
+		return NULL;
+	}
+
+	while (getline(&line, &size, f) > 0) {
+		char *ptr = line, *end;
+
+		while (isspace(*ptr))
+			ptr++;
+		if (*ptr == '\0' || *ptr == '#')
+			continue;
+
+		end = ptr;
+		while (*end && !isspace(*end))
+			end++;
+		if (*end)
+			*end++ = '\0';
+
+		double duration = DEFAULT_DURATION;
+		while (isspace(*end))
+			end++;
+		if (*end) {
+			char *invalid;
+			duration = strtod(end, &invalid);
+			while (isspace(*invalid))
+				invalid++;
+			if (*invalid || duration <= 0) {
+				printf("invalid duration for '%s' in playlist: %s", ptr, end);
+				goto fail;
+			}
+		}
+
+		playlist.entries = realloc(playlist.entries,
+		                           (playlist.count + 1) * sizeof(*playlist.entries));
+		playlist.entries[playlist.count++] = (struct playlist_entry) {
+			.file = resolve_path(file, ptr),
+			.duration = duration,
+		};
+	}
+
+	free(line);
+	fclose(f);
+
+	if (!playlist.count) {
+		printf("empty playlist '%s'\n", file);
+		return NULL;
+	}
+
+	printf("Loaded playlist with %u shader(s)\n", playlist.count);
+
+	return playlist.entries[0].file;
+
+fail:
+	free(line);
+	fclose(f);
+	return NULL;
+}
+
+static void preload_next(void)
+{
+	do {
+		playlist.next = (playlist.next + 1) % playlist.count;
+		if (playlist.next == playlist.current) {
+			/* no other shader to switch to */
+			playlist.job = NULL;
+			return;
+		}
+		playlist.job = compile_shadertoy(playlist.entries[playlist.next].file);
+	} while (!playlist.job);
+}
+
+/* Start playing, once the first shader is shown */
+void start_playlist(void)
+{
+	playlist.current = 0;
+	playlist.next = 0;
+	playlist.frames = 0;
+	playlist.start_time = get_time_ns();
+
+	preload_next();
+}
+
+static void account_current(uint64_t time)
+{
+	struct playlist_entry *entry = &playlist.entries[playlist.current];
+
+	entry->frames += playlist.frames;
+	entry->elapsed_time += time - playlist.start_time;
+
+	double secs = (time - playlist.start_time) / (double) NSEC_PER_SEC;
+	printf("Played %s: %u frames in %f sec (%f fps)\n",
+	       entry->file, playlist.frames, secs, playlist.frames / secs);
+}
+
+/* Called once per frame, returns true when the next shader has to be
+ * switched to, in which case the caller takes ownership of the program.
+ */
+bool update_playlist(uint64_t time, GLuint *program, const char **file)
+{
+	struct playlist_entry *entry = &playlist.entries[playlist.current];
+
+	playlist.frames++;
+
+	while (playlist.job) {
+		enum compile_status status = compile_job_status(playlist.job);
+
+		if (status == COMPILE_FAILED) {
+			printf("failed to build %s, skipping it\n",
+			       playlist.entries[playlist.next].file);
+			free_compile_job(playlist.job);
+			preload_next();
+			continue;
+		}
+
+		if (time - playlist.start_time < entry->duration * NSEC_PER_SEC)
+			return false;
+
+		if (status == COMPILE_PENDING) {
+			if (!playlist.late) {
+				printf("%s is not ready yet, extending %s\n",
+				       playlist.entries[playlist.next].file, entry->file);
+				playlist.late = true;
+			}
+			return false;
+		}
+
+		int ret = compile_job_take_program(playlist.job, NULL, NULL);
+		free_compile_job(playlist.job);
+
+		account_current(time);
+
+		playlist.current = playlist.next;
+		playlist.start_time = time;
+		playlist.frames = 0;
+		playlist.late = false;
+
+		*program = ret;
+		*file = playlist.entries[playlist.current].file;
+
+		preload_next();
+
+		return true;
+	}
+
+	return false;
+}
+
+void dump_playlist(void)
+{
+	if (!playlist.count)
+		return;
+
+	account_current(get_time_ns());
+
+	printf("Playlist summary:\n");
+	for (unsigned i = 0; i < playlist.count; i++) {
+		struct playlist_entry *entry = &playlist.entries[i];
+		double secs = entry->elapsed_time / (double) NSEC_PER_SEC;
+
+		printf("  %s: %u frames in %f sec (%f fps)\n", entry->file,
+		       entry->frames, secs, secs > 0 ? entry->frames / secs : 0);
+	}
+}
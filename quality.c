@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/* Module to hold a target frame rate, by switching between variants of the
+ * shader built with different values of its quality knobs, i.e. #define
+ * directives annotated with the values, from the lowest to the highest
+ * quality, e.g.:
+ *
+ *   // @quality AA 1 2 4
+ *   #define AA 4
+ *
+ * Knobs are combined into levels, and the variants of all the levels are
+ * built in the background by the compiler thread.  The frame rate is
+ * measured over short windows: the level is lowered as soon as it drops
+ * below the target, and raised after it's been held for a while.  When a
+ * raise fails, the hold time of that level is doubled, so that the
+ * governor does not keep oscillating between two levels.
+ *
+ * The thermal governor can also limit the highest level, to lower the
+ * rendering load before it caps the frame rate.
+ */
+
+#define MAX_QUALITY_VALUES 8
+
+/* Measurement window */
+#define WINDOW_NS (NSEC_PER_SEC / 2)
+/* The level is lowered below (1 - DOWN_MARGIN) * target, and raised from
+ * above (1 - UP_MARGIN) * target, as the frame rate can't exceed the
+ * refresh rate.
+ */
+#define DOWN_MARGIN 0.05
+#define UP_MARGIN 0.02
+/* A raise that's reverted within the probation period has failed */
+#define PROBATION_NS (2 * NSEC_PER_SEC)
+#define INITIAL_HOLD_NS (2 * NSEC_PER_SEC)
+#define MAX_HOLD_NS (64 * NSEC_PER_SEC)
+
+struct quality_knob {
+	char *name;
+	char *values[MAX_QUALITY_VALUES];
+	unsigned count;
+};
+
+struct quality_level {
+	char *defines[MAX_DEFINES];
+	struct compile_job *job;
+	GLuint program;
+	uint64_t hold;
+
+	/* statistics */
+	unsigned frames;
+	uint64_t elapsed_time;
+};
+
+static struct {
+	struct quality_knob knobs[MAX_DEFINES];
+	unsigned num_knobs;
+	struct quality_level *levels;
+	unsigned count;
+
+	float target_fps;
+	unsigned current;
+	/* highest level allowed by the thermal governor */
+	unsigned ceiling;
+	uint64_t level_start;
+	unsigned level_frames;
+	uint64_t raise_time;
+	uint64_t stable_since;
+	unsigned switches;
+
+	uint64_t window_start;
+	unsigned window_frames;
+} quality;
+
+/* Parse the '// @quality NAME VALUE...' annotation of the line, if any */
+static int parse_annotation(const char *line, size_t length)
+{
+	char *copy = strndup(line, length), *ptr, *token, *saveptr;
+	struct quality_knob *knob;
+
+	ptr = strstr(copy, "//");
+	if (!ptr)
+		goto out;
+	ptr += 2;
+	while (isspace(*ptr))
+		ptr++;
+	if (strncmp(ptr, "@quality", 8) || !isspace(ptr[8]))
+		goto out;
+
+	token = strtok_r(ptr + 8, " \t\r", &saveptr);
+	if (!token) {
+		printf("missing knob name in quality annotation: %s\n", copy);
+		goto fail;
+	}
+	if (quality.num_knobs == MAX_DEFINES) {
+		printf("at most %d quality knobs are supported\n", MAX_DEFINES);
+		goto fail;
+	}
+
+	knob = &quality.knobs[quality.num_knobs];
+	knob->name = strdup(token);
+	while ((token = strtok_r(NULL, " \t\r", &saveptr))) {
+		if (knob->count == MAX_QUALITY_VALUES) {
+			printf("at most %d values are supported for quality knob %s\n",
+			       MAX_QUALITY_VALUES, knob->name);
+			goto fail;
+		}
+		knob->values[knob->count++] = strdup(token);
+	}
+	if (!knob->count) {
+		printf("missing values for quality knob %s\n", knob->name);
+		goto fail;
+	}
+	quality.num_knobs++;
+
+out:
+	free(copy);
+	return 0;
+
+fail:
+	free(copy);
+	return -1;
+}
+
+/* Parse the quality annotations of the shader, and set up the levels,
+ * returning their number, or 0 when it has no knobs.
+ */
+int init_quality(const char *shader, float target_fps)
+{
+	unsigned count = 0;
+
+	for (const char *line = shader; *line;) {
+		const char *end = strchrnul(line, '\n');
+
+		if (parse_annotation(line, end - line))
+			return -1;
+
+		line = *end ? end + 1 : end;
+	}
+
+	if (!quality.num_knobs) {
+		printf("No '// @quality' annotations in the shader, disabling the quality governor\n");
+		return 0;
+	}
+
+	for (unsigned k = 0; k < quality.num_knobs; k++)
+		count = MAX2(count, quality.knobs[k].count);
+
+	/* Each level interpolates the values of every knob */
+	quality.levels = calloc(count, sizeof(*quality.levels));
+	quality.count = count;
+	for (unsigned l = 0; l < count; l++) {
+		struct quality_level *level = &quality.levels[l];
+
+		for (unsigned k = 0; k < quality.num_knobs; k++) {
+			const struct quality_knob *knob = &quality.knobs[k];
+			unsigned index = count > 1 ? (l * (knob->count - 1) + (count - 1) / 2) / (count - 1) : 0;
+
+			asprintf(&level->defines[k], "%s=%s", knob->name, knob->values[index]);
+		}
+		level->hold = INITIAL_HOLD_NS;
+	}
+
+	quality.target_fps = target_fps;
+	quality.current = count - 1;
+	quality.ceiling = count - 1;
+
+	printf("Holding %.1f fps with %u quality level(s)\n", target_fps, count);
+
+	return count;
+}
+
+/* The NULL-terminated NAME=VALUE definitions of the level */
+const char *const *quality_defines(unsigned level)
+{
+	return (const char *const *) quality.levels[level].defines;
+}
+
+static void print_level(const char *action, float fps)
+{
+	const struct quality_level *level = &quality.levels[quality.current];
+
+	printf("%s quality to level %u/%u (", action, quality.current + 1, quality.count);
+	for (unsigned k = 0; k < quality.num_knobs; k++)
+		printf("%s%s", k ? " " : "", level->defines[k]);
+	printf(") at %.1f fps\n", fps);
+}
+
+/* Start governing, once the variant of the highest level is shown with
+ * the given program, building the lower levels in the background.
+ */
+void start_quality(const char *shader, GLuint program)
+{
+	uint64_t time = get_time_ns();
+
+	quality.levels[quality.current].program = program;
+
+	/* The compiler thread builds the nearest levels first */
+	for (int l = quality.current - 1; l >= 0; l--) {
+		quality.levels[l].job = compile_shadertoy_variant(shader, quality_defines(l));
+	}
+
+	quality.level_start = time;
+	quality.stable_since = time;
+	quality.window_start = time;
+
+	thermal_quality_levels(quality.count);
+}
+
+static void poll_jobs(void)
+{
+	for (unsigned l = 0; l < quality.count; l++) {
+		struct quality_level *level = &quality.levels[l];
+
+		if (!level->job || compile_job_status(level->job) == COMPILE_PENDING)
+			continue;
+
+		int ret = compile_job_take_program(level->job, NULL, NULL);
+		free_compile_job(level->job);
+		level->job = NULL;
+
+		if (ret < 0) {
+			printf("failed to build quality level %u, skipping it\n", l + 1);
+		} else {
+			level->program = ret;
+		}
+	}
+}
+
+static void account_current(uint64_t time)
+{
+	struct quality_level *level = &quality.levels[quality.current];
+
+	level->frames += quality.level_frames;
+	level->elapsed_time += time - quality.level_start;
+
+	quality.level_start = time;
+	quality.level_frames = 0;
+}
+
+static void switch_level(unsigned l, uint64_t time)
+{
+	account_current(time);
+
+	quality.current = l;
+	quality.stable_since = time;
+	quality.switches++;
+}
+
+/* Called once per frame, returns true when the program of another level has
+ * to be switched to.  The programs remain owned by the governor.
+ */
+bool update_quality(uint64_t time, GLuint *program)
+{
+	float fps, target = quality.target_fps;
+	int l;
+
+	if (!quality.count)
+		return false;
+
+	poll_jobs();
+
+	quality.level_frames++;
+	quality.window_frames++;
+	if (time - quality.window_start < WINDOW_NS)
+		return false;
+
+	fps = quality.window_frames * (float) NSEC_PER_SEC / (time - quality.window_start);
+	quality.window_start = time;
+	quality.window_frames = 0;
+
+	/* Down to the nearest built level under the thermal limit */
+	if (thermal_quality_ceiling(&quality.ceiling) && quality.current > quality.ceiling) {
+		for (l = quality.ceiling; l > 0 && !quality.levels[l].program; l--);
+		if (!quality.levels[l].program)
+			return false;
+
+		switch_level(l, time);
+		print_level("Thermally lowered", fps);
+	} else if (fps < target * (1 - DOWN_MARGIN)) {
+		for (l = quality.current - 1; l >= 0 && !quality.levels[l].program; l--);
+		if (l < 0)
+			return false;
+
+		if (time - quality.raise_time < PROBATION_NS) {
+			struct quality_level *failed = &quality.levels[quality.current];
+			failed->hold = MIN2(failed->hold * 2, MAX_HOLD_NS);
+		}
+
+		switch_level(l, time);
+		print_level("Lowered", fps);
+	} else if (fps >= target * (1 - UP_MARGIN)) {
+		for (l = quality.current + 1; l < (int) quality.count && !quality.levels[l].program; l++);
+		if (l > (int) quality.ceiling || time - quality.stable_since < quality.levels[l].hold)
+			return false;
+
+		switch_level(l, time);
+		quality.raise_time = time;
+		print_level("Raised", fps);
+	} else {
+		quality.stable_since = time;
+		return false;
+	}
+
+	*program = quality.levels[quality.current].program;
+
+	return true;
+}
+
+void dump_quality(void)
+{
+	if (!quality.count)
+		return;
+
+	account_current(get_time_ns());
+
+	printf("Quality summary (%u switches):\n", quality.switches);
+	for (unsigned l = 0; l < quality.count; l++) {
+		struct quality_level *level = &quality.levels[l];
+		double secs = level->elapsed_time / (double) NSEC_PER_SEC;
+
+		printf("  level %u: %u frames in %f sec (%f fps)\n", l + 1,
+		       level->frames, secs, secs > 0 ? level->frames / secs : 0);
+	}
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+
+/* Module to run the render thread with a real-time scheduling policy, on
+ * selected CPUs, with its memory locked, so that background tasks do not
+ * preempt it past the vblanks.
+ *
+ * Either policy requires CAP_SYS_NICE, or an RLIMIT_RTPRIO for SCHED_FIFO,
+ * and the default scheduling is kept otherwise.
+ *
+ * The latencies between the intended wake up times, i.e. the page flips and
+ * the timer deadlines, and the times the render thread actually runs, are
+ * accumulated, to compare them across policies.
+ */
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* Priority of the render thread, in the middle of the SCHED_FIFO range, just
+ * below the threaded interrupts, at 50, so that the GPU and the vblank
+ * interrupts, the render thread waits on, are not delayed by it.
+ */
+#define FIFO_PRIORITY 49
+/* Share of the refresh interval reserved to the render thread with
+ * SCHED_DEADLINE, for its own CPU time, waits excluded.
+ */
+#define DEADLINE_RUNTIME 0.5
+/* Wake ups later than this are counted as late */
+#define LATE_NS (NSEC_PER_SEC / 1000)
+
+/* As the sched_setattr() system call expects it, without a glibc wrapper */
+struct deadline_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static struct {
+	enum scheduling policy;
+	bool affinity;
+	cpu_set_t cpus;
+	uint64_t period;
+
+	/* accumulated wake up latencies */
+	unsigned wakeups;
+	unsigned late;
+	double total;
+	uint64_t max;
+} rt;
+
+/* Parses a list of CPUs, e.g. 2,3 or 0-1,4 */
+static int parse_cpus(const char *list, cpu_set_t *cpus)
+{
+	const char *ptr = list;
+	char *end;
+
+	CPU_ZERO(cpus);
+	while (*ptr) {
+		unsigned long first = strtoul(ptr, &end, 10), last = first;
+		if (end == ptr)
+			return -1;
+		if (*end == '-') {
+			ptr = end + 1;
+			last = strtoul(ptr, &end, 10);
+			if (end == ptr || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, cpus);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		ptr = end;
+	}
+
+	return CPU_COUNT(cpus) ? 0 : -1;
+}
+
+int init_realtime(const struct options *options, float refresh)
+{
+	rt.policy = options->scheduling;
+	rt.period = refresh > 0 ? NSEC_PER_SEC / refresh : 0;
+
+	if (rt.policy == SCHEDULING_DEADLINE && !rt.period) {
+		printf("Unknown refresh interval, for SCHED_DEADLINE\n");
+		return -1;
+	}
+
+	if (options->cpu_affinity) {
+		if (parse_cpus(options->cpu_affinity, &rt.cpus)) {
+			printf("invalid CPU list: %s\n", options->cpu_affinity);
+			return -1;
+		}
+		rt.affinity = true;
+	}
+
+	return 0;
+}
+
+static int set_deadline(void)
+{
+	struct deadline_attr attr = {
+			.size = sizeof(attr),
+			.sched_policy = SCHED_DEADLINE,
+			.sched_runtime = DEADLINE_RUNTIME * rt.period,
+			.sched_deadline = rt.period,
+			.sched_period = rt.period,
+	};
+
+	return syscall(SYS_sched_setattr, 0, &attr, 0);
+}
+
+/* Applies the scheduling to the calling thread, that runs the frame loop */
+void start_realtime(void)
+{
+	if (rt.policy == SCHEDULING_DEFAULT && !rt.affinity)
+		return;
+
+	/* Page faults would stall the thread as much as preemptions */
+	if (rt.policy != SCHEDULING_DEFAULT && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		printf("Not locking the memory: %s\n", strerror(errno));
+	}
+
+	/* SCHED_DEADLINE tasks cannot be restricted to a subset of the CPUs of
+	 * their root domain, so the affinity is set before, and dropped when
+	 * rejected.
+	 */
+	if (rt.affinity) {
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(rt.cpus), &rt.cpus);
+		if (ret) {
+			printf("Not setting the CPU affinity: %s\n", strerror(ret));
+			rt.affinity = false;
+		}
+	}
+
+	if (rt.policy == SCHEDULING_FIFO) {
+		struct sched_param param = {
+				.sched_priority = FIFO_PRIORITY,
+		};
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret) {
+			printf("Not permitted to use SCHED_FIFO, keeping the default scheduling: %s\n", strerror(ret));
+			rt.policy = SCHEDULING_DEFAULT;
+		}
+	} else if (rt.policy == SCHEDULING_DEADLINE) {
+		int ret = set_deadline();
+		if (ret && errno == EPERM && rt.affinity) {
+			cpu_set_t all;
+
+			CPU_ZERO(&all);
+			for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; cpu++)
+				CPU_SET(cpu, &all);
+			pthread_setaffinity_np(pthread_self(), sizeof(all), &all);
+			rt.affinity = false;
+			printf("Dropping the CPU affinity, for SCHED_DEADLINE\n");
+
+			ret = set_deadline();
+		}
+		if (ret) {
+			printf("Not permitted to use SCHED_DEADLINE, keeping the default scheduling: %s\n", strerror(errno));
+			rt.policy = SCHEDULING_DEFAULT;
+		}
+	}
+
+	if (rt.policy == SCHEDULING_FIFO) {
+		printf("Rendering with SCHED_FIFO, at priority %d\n", FIFO_PRIORITY);
+	} else if (rt.policy == SCHEDULING_DEADLINE) {
+		printf("Rendering with SCHED_DEADLINE, for %.3f ms every %.3f ms\n",
+		       DEADLINE_RUNTIME * rt.period / 1e6, rt.period / 1e6);
+	}
+}
+
+/* Accounts for a wake up at actual time, intended at time intended */
+void record_wakeup(uint64_t intended, uint64_t actual)
+{
+	uint64_t latency = actual > intended ? actual - intended : 0;
+
+	rt.wakeups++;
+	rt.total += latency;
+	rt.max = MAX2(rt.max, latency);
+	if (latency > LATE_NS)
+		rt.late++;
+}
+
+void dump_realtime(void)
+{
+	static const char *policies[] = {
+			[SCHEDULING_DEFAULT] = "default",
+			[SCHEDULING_FIFO] = "SCHED_FIFO",
+			[SCHEDULING_DEADLINE] = "SCHED_DEADLINE",
+	};
+
+	if (!rt.wakeups)
+		return;
+
+	printf("Wake up latency (%s scheduling): %.3f ms mean, %.3f ms max, %u of %u over %.1f ms\n",
+	       policies[rt.policy], rt.total / rt.wakeups / 1e6, rt.max / 1e6,
+	       rt.late, rt.wakeups, LATE_NS / 1e6);
+}
@@ -23,17 +23,20 @@
 
 #define _GNU_SOURCE
 
+#include <ctype.h>
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <regex.h>
 #include <stdlib.h>
+#include <time.h>
 
-#include <GLES3/gl3.h>
+#include <GLES3/gl31.h>
 
 #include "common.h"
 
@@ -43,18 +46,196 @@ static nvmlDevice_t nvml_device;
 static bool nvml_available = false;
 #endif
 
-GLint iTime, iFrame;
+struct shadertoy {
+	GLuint program;
+	// Index of the pass built-in inputs, in the uniform buffer
+	unsigned slot;
+	// Render resolution, and channels bound to buffers
+	int width, height;
+	const char *channels;
+	// Built-in uniform locations, for GLSL ES 1.00
+	GLint iResolution, iTime, iTimeDelta, iFrameRate, iFrame, iMouse, iDate, iChannelResolution;
+	// Playback start, when switched to from a playlist
+	uint64_t start_time;
+	unsigned start_frame;
+	// Workgroup size of the compute variant, zero for fragment passes
+	GLuint local_size[2];
+};
+
+// Built-in inputs of a pass, laid out as the std140 ShadertoyInputs block
+struct shadertoy_inputs {
+	GLfloat iResolution[3];
+	GLfloat iTime;
+	GLfloat iMouse[4];
+	GLfloat iDate[4];
+	GLfloat iTimeDelta;
+	GLfloat iFrameRate;
+	GLint iFrame;
+	GLint padding;
+	GLfloat iChannelResolution[NUM_CHANNELS][4];
+};
+
+#define SLOT_CURRENT   0
+#define SLOT_PREVIOUS  1
+#define SLOT_BUFFER(i) (2 + (i))
+#define NUM_SLOTS      SLOT_BUFFER(MAX_PASS_BUFFERS)
+
+// Built-in inputs of all the passes, uploaded once per frame
+static struct {
+	GLuint ubo;
+	GLint stride;
+	unsigned char *data;
+	GLfloat mouse[4];
+	uint64_t last_time;
+} builtins;
+
+// The shown program, and the outgoing one during a crossfade
+static struct shadertoy current, previous;
+static bool playing = false;
+// Whether the quality governor switches between variants of the shader
+static bool governed = false;
+
 static bool show_hud = false;
 static uint32_t screen_width = 0;
 static uint32_t screen_height = 0;
 static const char *shader_filename = NULL;
 
+// Detected GLSL version
+static char *glsl_version_str = NULL;
+static char *version_directive = NULL;
+static bool is_glsl_3 = false;
+static bool has_compute = false;
+
 // Simple shader for FPS overlay
 static GLuint fps_program = 0;
 static GLuint fps_vbo = 0;
-static GLuint shadertoy_program = 0;
 static GLuint shadertoy_vbo = 0;
 
+// Buffer passes, rendered before the image pass, to ping-pong framebuffers
+struct buffer {
+	struct shadertoy pass;
+	char channels[NUM_CHANNELS];
+	struct framebuffer fbs[2];
+	// Index of the framebuffer holding the latest result
+	unsigned latest;
+};
+
+static struct {
+	struct buffer buffers[MAX_PASS_BUFFERS];
+	unsigned count;
+	// Buffers in rendering order, so that dependencies are rendered first
+	unsigned order[MAX_PASS_BUFFERS];
+	// Channels of the image pass
+	char channels[NUM_CHANNELS];
+	char *declarations;
+	GLuint units[NUM_CHANNELS];
+} passes;
+
+// Compile time specialization, of the built-in inputs and #define directives
+static struct {
+	bool enabled;
+	// iMouse is constant, when it's not fed by inputs
+	bool mouse;
+	const char *const *defines;
+} specialization;
+
+// Precision of the image pass, buffers always use highp when available
+static enum precision precision_mode;
+
+// Compute path of the image pass, writing to an image blitted to the framebuffer
+static struct {
+	bool enabled;
+	GLuint local_size[2];
+	GLuint tex, fb;
+} compute;
+
+// Crossfade between playlist shaders, rendered offscreen then blended
+static struct {
+	float duration;
+	GLuint program;
+	GLint progress;
+	GLuint units[2];
+	struct framebuffer fbs[2];
+	uint64_t start_time;
+} crossfade;
+
+static const char *crossfade_vs =
+		"attribute vec2 position;                                     \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    uv = position * 0.5 + 0.5;                               \n"
+		"    gl_Position = vec4(position, 0.0, 1.0);                  \n"
+		"}                                                            \n";
+
+static const char *crossfade_fs =
+		"precision mediump float;                                     \n"
+		"                                                             \n"
+		"uniform sampler2D from;                                      \n"
+		"uniform sampler2D to;                                        \n"
+		"uniform float progress;                                      \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    gl_FragColor = mix(texture2D(from, uv), texture2D(to, uv), progress);\n"
+		"}                                                            \n";
+
+// Blend between the last two renders, presented on the vblanks between them
+// when rendering at a lower rate than the refresh rate
+static struct {
+	bool enabled;
+	GLuint program;
+	GLint progress;
+	GLuint units[2];
+	struct framebuffer fbs[2];
+	unsigned latest;
+	unsigned renders;
+} interpolation;
+
+// Reduced shading rate mode of the image pass, if any
+static const struct shading_rate *shading_rate;
+
+// Static content: frames are only rendered when their content changes, and
+// only over the changed region, i.e. the FPS counter of the HUD
+#define MAX_BUFFER_AGE 4
+
+static struct {
+	bool enabled;
+	// Inputs read by the image pass
+	bool animated;
+	bool interactive;
+	// Content of the presented frame
+	bool presented;
+	GLuint program;
+	GLfloat mouse[4];
+	// Damage of the next frame, and of the previous ones by age
+	int rect[4];
+	int history[MAX_BUFFER_AGE][4];
+	const struct egl *egl;
+} still;
+
+// Redirects the time dependent inputs and iMouse to uniforms of their own,
+// as all the members of the std140 block of the inputs are active
+static const struct {
+	const char *name;
+	const char *type;
+} probed_inputs[] = {
+		{"iTime",      "float"},
+		{"iTimeDelta", "float"},
+		{"iFrameRate", "float"},
+		{"iFrame",     "int"},
+		{"iDate",      "vec4"},
+		{"iMouse",     "vec4"},
+};
+
+// GPU timer of the image pass
+static int image_timer = -1;
+
+// Pending hot-reload, submitted by shader_changed() from the event loop
+static struct compile_job *reload_job;
+
 static const char *shadertoy_vs_tmpl_100 =
 		"// version (default: 1.10)              \n"
 		"%s                                      \n"
@@ -81,52 +262,113 @@ static const char *shadertoy_fs_tmpl_100 =
 		"// version (default: 1.10)                                                           \n"
 		"%s                                                                                   \n"
 		"                                                                                     \n"
-		"#ifdef GL_FRAGMENT_PRECISION_HIGH                                                    \n"
-		"precision highp float;                                                               \n"
-		"#else                                                                                \n"
-		"precision mediump float;                                                             \n"
-		"#endif                                                                               \n"
+		"// precision                                                                         \n"
+		"%s                                                                                   \n"
 		"                                                                                     \n"
 		"uniform vec3      iResolution;           // viewport resolution (in pixels)          \n"
 		"uniform float     iTime;                 // shader playback time (in seconds)        \n"
 		"uniform int       iFrame;                // current frame number                     \n"
 		"uniform vec4      iMouse;                // mouse pixel coords                       \n"
 		"uniform vec4      iDate;                 // (year, month, day, time in seconds)      \n"
-		"                                                                                     \n"
+		"uniform float     iTimeDelta;            // render time (in seconds)                 \n"
+		"uniform float     iFrameRate;            // shader frame rate                        \n"
+		"uniform vec3      iChannelResolution[4]; // channel resolution (in pixels)           \n"
+		"%s                                                                                   \n"
 		"// Shader body                                                                       \n"
 		"%s                                                                                   \n"
 		"                                                                                     \n"
+		"#ifndef kms_FragCoord                                                                \n"
+		"#define kms_FragCoord gl_FragCoord.xy                                                \n"
+		"#endif                                                                               \n"
+		"                                                                                     \n"
 		"void main()                                                                          \n"
 		"{                                                                                    \n"
-		"    mainImage(gl_FragColor, gl_FragCoord.xy);                                        \n"
+		"    mainImage(gl_FragColor, kms_FragCoord);                                          \n"
 		"}                                                                                    \n";
 
 static const char *shadertoy_fs_tmpl_300 =
 		"// version                                                                           \n"
 		"%s                                                                                   \n"
 		"                                                                                     \n"
-		"#ifdef GL_FRAGMENT_PRECISION_HIGH                                                    \n"
-		"precision highp float;                                                               \n"
-		"#else                                                                                \n"
-		"precision mediump float;                                                             \n"
-		"#endif                                                                               \n"
+		"// precision                                                                         \n"
+		"%s                                                                                   \n"
 		"                                                                                     \n"
 		"out vec4 fragColor;                                                                  \n"
 		"                                                                                     \n"
-		"uniform vec3      iResolution;           // viewport resolution (in pixels)          \n"
-		"uniform float     iTime;                 // shader playback time (in seconds)        \n"
-		"uniform int       iFrame;                // current frame number                     \n"
-		"uniform vec4      iMouse;                // mouse pixel coords                       \n"
-		"uniform vec4      iDate;                 // (year, month, day, time in seconds)      \n"
+		"layout(std140) uniform ShadertoyInputs {                                             \n"
+		"    vec3      iResolution;               // viewport resolution (in pixels)          \n"
+		"    float     iTime;                     // shader playback time (in seconds)        \n"
+		"    vec4      iMouse;                    // mouse pixel coords                       \n"
+		"    vec4      iDate;                     // (year, month, day, time in seconds)      \n"
+		"    float     iTimeDelta;                // render time (in seconds)                 \n"
+		"    float     iFrameRate;                // shader frame rate                        \n"
+		"    int       iFrame;                    // current frame number                     \n"
+		"    vec3      iChannelResolution[4];     // channel resolution (in pixels)           \n"
+		"};                                                                                   \n"
+		"%s                                                                                   \n"
+		"// Shader body                                                                       \n"
+		"%s                                                                                   \n"
+		"                                                                                     \n"
+		"#ifndef kms_FragCoord                                                                \n"
+		"#define kms_FragCoord gl_FragCoord.xy                                                \n"
+		"#endif                                                                               \n"
+		"                                                                                     \n"
+		"void main()                                                                          \n"
+		"{                                                                                    \n"
+		"    mainImage(fragColor, kms_FragCoord);                                             \n"
+		"}                                                                                    \n";
+
+static const char *shadertoy_cs_tmpl_310 =
+		"// version (at least 3.10)                                                           \n"
+		"%s                                                                                   \n"
+		"                                                                                     \n"
+		"// precision                                                                         \n"
+		"%s                                                                                   \n"
+		"                                                                                     \n"
+		"layout(local_size_x = %u, local_size_y = %u) in;                                     \n"
+		"layout(rgba8, binding = 0) writeonly uniform highp image2D kms_image;                \n"
 		"                                                                                     \n"
+		"layout(std140) uniform ShadertoyInputs {                                             \n"
+		"    vec3      iResolution;               // viewport resolution (in pixels)          \n"
+		"    float     iTime;                     // shader playback time (in seconds)        \n"
+		"    vec4      iMouse;                    // mouse pixel coords                       \n"
+		"    vec4      iDate;                     // (year, month, day, time in seconds)      \n"
+		"    float     iTimeDelta;                // render time (in seconds)                 \n"
+		"    float     iFrameRate;                // shader frame rate                        \n"
+		"    int       iFrame;                    // current frame number                     \n"
+		"    vec3      iChannelResolution[4];     // channel resolution (in pixels)           \n"
+		"};                                                                                   \n"
+		"%s                                                                                   \n"
 		"// Shader body                                                                       \n"
 		"%s                                                                                   \n"
 		"                                                                                     \n"
 		"void main()                                                                          \n"
 		"{                                                                                    \n"
-		"    mainImage(fragColor, gl_FragCoord.xy);                                           \n"
+		"    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);                                   \n"
+		"    if (any(greaterThanEqual(coord, imageSize(kms_image))))                          \n"
+		"        return;                                                                      \n"
+		"    vec4 color = vec4(0.0);                                                          \n"
+		"    mainImage(color, vec2(coord) + 0.5);                                             \n"
+		"    imageStore(kms_image, coord, color);                                             \n"
 		"}                                                                                    \n";
 
+static const char *precision_statements[] = {
+		[PRECISION_HIGHP] =
+		"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+		"precision highp float;\n"
+		"#else\n"
+		"precision mediump float;\n"
+		"#endif",
+		[PRECISION_MEDIUMP] =
+		"precision mediump float;",
+};
+
+static const char *precision_names[] = {
+		[PRECISION_HIGHP] = "highp",
+		[PRECISION_MEDIUMP] = "mediump",
+		[PRECISION_AUTO] = "auto",
+};
+
 static const GLfloat vertices[] = {
 		// First triangle:
 		1.0f, 1.0f,
@@ -138,21 +380,44 @@ static const GLfloat vertices[] = {
 		1.0f, 1.0f,
 };
 
-static const char *load_shader(const char *file) {
+/* Read the shader file into a NUL-terminated buffer, to be freed by the caller */
+static char *read_shader(const char *file) {
 	struct stat statbuf;
-	int fd, ret;
+	char *shader;
+	int fd;
 
-	fd = open(file, 0);
+	fd = open(file, O_RDONLY);
 	if (fd < 0) {
-		err(fd, "could not open '%s'", file);
+		printf("could not open '%s': %s\n", file, strerror(errno));
+		return NULL;
 	}
 
-	ret = fstat(fd, &statbuf);
-	if (ret < 0) {
-		err(ret, "could not stat '%s'", file);
+	if (fstat(fd, &statbuf) < 0) {
+		printf("could not stat '%s': %s\n", file, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	shader = malloc(statbuf.st_size + 1);
+	ssize_t len = 0;
+	while (len < statbuf.st_size) {
+		ssize_t ret = read(fd, shader + len, statbuf.st_size - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+
+	if (len != statbuf.st_size) {
+		printf("could not read '%s'\n", file);
+		free(shader);
+		return NULL;
 	}
+	shader[len] = '\0';
 
-	return mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	return shader;
 }
 
 #define GLSL_VERSION_REGEX "GLSL[[:space:]]*(ES)?[[:space:]]*([[:digit:]]+)\\.([[:digit:]]+)"
@@ -379,6 +644,17 @@ static void draw_char(int x, int y, int char_index, float scale, GLfloat *vertic
 	}
 }
 
+/* The region of the FPS counter, in the bottom right corner, from the bottom left */
+static void hud_rect(int rect[4]) {
+	// Layout of draw_fps_counter(), for up to 24 characters
+	int char_width = 12, char_height = 16, padding = 10;
+
+	rect[0] = MAX2(0, (int) screen_width - 24 * char_width - padding);
+	rect[1] = 0;
+	rect[2] = screen_width - rect[0];
+	rect[3] = MIN2(char_height + padding, (int) screen_height);
+}
+
 static void draw_fps_counter(float fps) {
 	if (!show_hud || fps <= 0.0f || fps_program == 0) return;
 	
@@ -473,158 +749,1857 @@ static void draw_fps_counter(float fps) {
 	glEnableVertexAttribArray(0);
 }
 
-static void draw_shadertoy(uint64_t start_time, unsigned frame, float fps) {
-	float time = ((float) (get_time_ns() - start_time)) / NSEC_PER_SEC;
+/* Texture units are reserved from the last one down, as the first ones are
+ * assigned to inputs.
+ */
+GLuint reserve_texture_unit(void) {
+	static GLint next = -1;
 
-	glUniform1f(iTime, time);
-	// Replace the above to input elapsed time relative to 60 FPS
-	// glUniform1f(iTime, (GLfloat) frame / 60.0f);
-	glUniform1ui(iFrame, frame);
+	if (next < 0) {
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &next);
+	}
 
-	for (uint i = 0; i < onRenderCallbacks.length; i++) {
-		((onRenderCallback) onRenderCallbacks.callbacks[i])(frame, time);
+	return --next;
+}
+
+/* Build a program drawing the full screen quad, with the uv coordinates of
+ * the fragments, e.g. to resolve an offscreen target to the frame.
+ */
+int create_quad_program(const char *fs_src) {
+	int ret;
+
+	ret = create_program(crossfade_vs, fs_src);
+	if (ret < 0) {
+		return -1;
 	}
 
-	start_perfcntrs();
+	glBindAttribLocation(ret, 0, "position");
+	if (link_program(ret)) {
+		return -1;
+	}
 
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+	return ret;
+}
 
-	end_perfcntrs();
-	
-	// Draw FPS counter overlay after main shader
-	draw_fps_counter(fps);
+static void set_channel_samplers(GLuint program, const char channels[NUM_CHANNELS]) {
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (channels[i]) {
+			char name[] = "iChannel0";
+			name[8] += i;
+			glUniform1i(glGetUniformLocation(program, name), passes.units[i]);
+		}
+	}
 }
 
-int init_shadertoy(const struct gbm *gbm, struct egl *egl, const char *file, const struct options *options) {
-	int ret;
-	char *shadertoy_vs, *shadertoy_fs;
-	GLuint program;
-	GLint iResolution;
-	
-	// Store settings
-	show_hud = options->show_hud;
-	screen_width = gbm->width;
-	screen_height = gbm->height;
-	
+/* Bind the latest result of the buffers the channels refer to */
+static void bind_channels(const char channels[NUM_CHANNELS]) {
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (channels[i]) {
+			const struct buffer *buffer = &passes.buffers[channels[i] - 'A'];
+			glActiveTexture(GL_TEXTURE0 + passes.units[i]);
+			glBindTexture(GL_TEXTURE_2D, buffer->fbs[buffer->latest].tex);
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void init_pass(struct shadertoy *pass, GLuint program, unsigned slot,
+                      int width, int height, const char *channels) {
+	pass->program = program;
+	pass->slot = slot;
+	pass->width = width;
+	pass->height = height;
+	pass->channels = channels;
+
+	if (is_glsl_3) {
+		GLuint index = glGetUniformBlockIndex(program, "ShadertoyInputs");
+		if (index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program, index, 0);
+		}
+	} else {
+		pass->iResolution = glGetUniformLocation(program, "iResolution");
+		pass->iTime = glGetUniformLocation(program, "iTime");
+		pass->iTimeDelta = glGetUniformLocation(program, "iTimeDelta");
+		pass->iFrameRate = glGetUniformLocation(program, "iFrameRate");
+		pass->iFrame = glGetUniformLocation(program, "iFrame");
+		pass->iMouse = glGetUniformLocation(program, "iMouse");
+		pass->iDate = glGetUniformLocation(program, "iDate");
+		pass->iChannelResolution = glGetUniformLocation(program, "iChannelResolution");
+	}
+}
+
+static void use_shadertoy(GLuint program) {
+	glUseProgram(program);
+
+	init_pass(&current, program, SLOT_CURRENT, screen_width, screen_height, passes.channels);
+	set_channel_samplers(program, passes.channels);
+
+	for (uint i = 0; i < onInitCallbacks.length; i++) {
+		((onInitCallback) onInitCallbacks.callbacks[i])(program, screen_width, screen_height);
+	}
+}
+
+static void set_shader_filename(const char *file) {
 	// Extract basename from file path for display
 	if (show_hud && file) {
 		const char *basename = strrchr(file, '/');
 		shader_filename = basename ? basename + 1 : file;
 	}
+}
 
-	const char *shader = load_shader(file);
+/* Switch to the next playlist program, fading the current one out if enabled */
+static void switch_shadertoy(GLuint program, const char *file, uint64_t time, unsigned frame) {
+	if (crossfade.duration > 0) {
+		if (previous.program) {
+			// The previous crossfade has not completed yet
+			glDeleteProgram(previous.program);
+		}
+		previous = current;
+		previous.slot = SLOT_PREVIOUS;
+		crossfade.start_time = time;
+	} else {
+		glDeleteProgram(current.program);
+	}
 
-	const char *version = glsl_version();
-	if (strlen(version) > 0) {
-		char *invalid;
-		long v = strtol(version, &invalid, 10);
-		if (invalid == version) {
-			printf("failed to parse detected GLSL version: %s\n", invalid);
-			return -1;
+	use_shadertoy(program);
+	current.start_time = time;
+	current.start_frame = frame;
+
+	set_shader_filename(file);
+}
+
+/* Swap in the reloaded program, if its build is complete. This never blocks
+ * on the compiler thread, so that no frame is dropped while it's running.
+ */
+static void reload_shadertoy(void) {
+	struct compile_job *job = NULL;
+	uint64_t build_time;
+	bool hit;
+
+	if (reload_job && compile_job_status(reload_job) != COMPILE_PENDING) {
+		job = reload_job;
+		reload_job = NULL;
+	}
+
+	if (!job)
+		return;
+
+	int program = compile_job_take_program(job, &hit, &build_time);
+	free_compile_job(job);
+
+	if (program < 0) {
+		printf("Failed to reload shader, keeping the current program\n");
+		return;
+	}
+
+	printf("Reloaded shader in %.1f ms (%s)\n",
+	       build_time / (double) (NSEC_PER_SEC / MSEC_PER_SEC),
+	       hit ? "cached binary" : "compiled from source");
+
+	glDeleteProgram(current.program);
+	use_shadertoy(program);
+}
+
+static struct shadertoy_inputs *pass_inputs(const struct shadertoy *pass) {
+	return (struct shadertoy_inputs *) (builtins.data + pass->slot * builtins.stride);
+}
+
+static float pass_time(const struct shadertoy *pass, uint64_t start_time, uint64_t time) {
+	return ((float) (time - MAX2(start_time, pass->start_time))) / NSEC_PER_SEC;
+	// Replace the above to input elapsed time relative to 60 FPS
+	// return (GLfloat) (frame - pass->start_frame) / 60.0f;
+}
+
+/* Set iMouse, from the inputs handled by the Python wrapper */
+void setMouse(float x, float y, float z, float w) {
+	builtins.mouse[0] = x;
+	builtins.mouse[1] = y;
+	builtins.mouse[2] = z;
+	builtins.mouse[3] = w;
+}
+
+static void update_pass_inputs(const struct shadertoy *pass, uint64_t start_time, uint64_t time,
+                               unsigned frame, float time_delta, float fps, const GLfloat date[4]) {
+	struct shadertoy_inputs *inputs = pass_inputs(pass);
+
+	inputs->iResolution[0] = pass->width;
+	inputs->iResolution[1] = pass->height;
+	inputs->iResolution[2] = 1.0f;
+	inputs->iTime = pass_time(pass, start_time, time);
+	memcpy(inputs->iMouse, builtins.mouse, sizeof(inputs->iMouse));
+	memcpy(inputs->iDate, date, sizeof(inputs->iDate));
+	inputs->iTimeDelta = time_delta;
+	inputs->iFrameRate = fps;
+	inputs->iFrame = frame - pass->start_frame;
+
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (pass->channels && pass->channels[i]) {
+			const struct shadertoy *buffer = &passes.buffers[pass->channels[i] - 'A'].pass;
+			inputs->iChannelResolution[i][0] = buffer->width;
+			inputs->iChannelResolution[i][1] = buffer->height;
+			inputs->iChannelResolution[i][2] = 1.0f;
 		}
-		char *version_directive;
-		asprintf(&version_directive, "#version %s", version);
-		printf("Using GLSL version directive: %s\n", version_directive);
+	}
+}
+
+/* Update the built-in inputs of all the passes, with a single upload */
+static void update_builtins(uint64_t start_time, unsigned frame, float fps) {
+	uint64_t time = get_time_ns();
+	float time_delta = builtins.last_time ? (float) (time - builtins.last_time) / NSEC_PER_SEC : 0.0f;
+	struct timespec now;
+	struct tm tm;
+	GLfloat date[4];
+
+	builtins.last_time = time;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &tm);
+	date[0] = tm.tm_year + 1900;
+	date[1] = tm.tm_mon;
+	date[2] = tm.tm_mday;
+	date[3] = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec + now.tv_nsec / (float) NSEC_PER_SEC;
+
+	update_pass_inputs(&current, start_time, time, frame, time_delta, fps, date);
+	if (previous.program) {
+		update_pass_inputs(&previous, start_time, time, frame, time_delta, fps, date);
+	}
+	for (unsigned i = 0; i < passes.count; i++) {
+		update_pass_inputs(&passes.buffers[i].pass, start_time, time, frame, time_delta, fps, date);
+	}
 
-		bool is_glsl_3 = v >= 300;
-		asprintf(&shadertoy_vs, is_glsl_3 ? shadertoy_vs_tmpl_300 : shadertoy_vs_tmpl_100, version_directive);
-		asprintf(&shadertoy_fs, is_glsl_3 ? shadertoy_fs_tmpl_300 : shadertoy_fs_tmpl_100, version_directive, shader);
+	if (is_glsl_3) {
+		glBindBuffer(GL_UNIFORM_BUFFER, builtins.ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, SLOT_BUFFER(passes.count) * builtins.stride, builtins.data);
+	}
+}
+
+/* Run the compute variant of the pass, and blit its image to the framebuffer */
+static void dispatch_shadertoy(const struct shadertoy *pass) {
+	GLint draw_fb;
+
+	glBindImageTexture(0, compute.tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glDispatchCompute((pass->width + pass->local_size[0] - 1) / pass->local_size[0],
+	                  (pass->height + pass->local_size[1] - 1) / pass->local_size[1], 1);
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fb);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, compute.fb);
+	glBlitFramebuffer(0, 0, pass->width, pass->height, 0, 0, pass->width, pass->height,
+	                  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_fb);
+}
+
+static void render_shadertoy(const struct shadertoy *pass) {
+	const struct shadertoy_inputs *inputs = pass_inputs(pass);
+
+	glUseProgram(pass->program);
+
+	if (is_glsl_3) {
+		glBindBufferRange(GL_UNIFORM_BUFFER, 0, builtins.ubo, pass->slot * builtins.stride,
+		                  sizeof(struct shadertoy_inputs));
 	} else {
-		asprintf(&shadertoy_vs, shadertoy_vs_tmpl_100, version);
-		asprintf(&shadertoy_fs, shadertoy_fs_tmpl_100, version, shader);
+		GLfloat channel_resolution[NUM_CHANNELS][3];
+
+		for (int i = 0; i < NUM_CHANNELS; i++) {
+			memcpy(channel_resolution[i], inputs->iChannelResolution[i], sizeof(channel_resolution[i]));
+		}
+
+		glUniform3fv(pass->iResolution, 1, inputs->iResolution);
+		glUniform1f(pass->iTime, inputs->iTime);
+		glUniform1f(pass->iTimeDelta, inputs->iTimeDelta);
+		glUniform1f(pass->iFrameRate, inputs->iFrameRate);
+		glUniform1i(pass->iFrame, inputs->iFrame);
+		glUniform4fv(pass->iMouse, 1, inputs->iMouse);
+		glUniform4fv(pass->iDate, 1, inputs->iDate);
+		glUniform3fv(pass->iChannelResolution, NUM_CHANNELS, &channel_resolution[0][0]);
 	}
 
-	ret = create_program(shadertoy_vs, shadertoy_fs);
-	if (ret < 0) {
-		printf("failed to create program\n");
-		return -1;
+	if (pass->local_size[0]) {
+		dispatch_shadertoy(pass);
+	} else {
+		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
+}
 
-	program = ret;
+static void init_builtins(void) {
+	builtins.stride = sizeof(struct shadertoy_inputs);
 
-	ret = link_program(program);
-	if (ret) {
-		printf("failed to link program\n");
-		return -1;
+	if (is_glsl_3) {
+		GLint alignment;
+
+		// Each pass binds its own range of the buffer
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		builtins.stride = (builtins.stride + alignment - 1) / alignment * alignment;
+
+		glGenBuffers(1, &builtins.ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, builtins.ubo);
+		glBufferData(GL_UNIFORM_BUFFER, NUM_SLOTS * builtins.stride, NULL, GL_DYNAMIC_DRAW);
 	}
 
-	glViewport(0, 0, gbm->width, gbm->height);
-	glUseProgram(program);
+	builtins.data = calloc(NUM_SLOTS, builtins.stride);
+}
 
-	iTime = glGetUniformLocation(program, "iTime");
-	iFrame = glGetUniformLocation(program, "iFrame");
-	iResolution = glGetUniformLocation(program, "iResolution");
-	glUniform3f(iResolution, gbm->width, gbm->height, 0);
+static void render_buffers(void) {
+	GLint target;
 
-	for (uint i = 0; i < onInitCallbacks.length; i++) {
-		((onInitCallback) onInitCallbacks.callbacks[i])(program, gbm->width, gbm->height);
+	if (!passes.count) {
+		return;
 	}
 
-	glGenBuffers(1, &shadertoy_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, shadertoy_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), &vertices[0]);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) (intptr_t) 0);
-	glEnableVertexAttribArray(0);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
 
-	// Store the shadertoy program for later restoration
-	shadertoy_program = program;
+	for (unsigned i = 0; i < passes.count; i++) {
+		struct buffer *buffer = &passes.buffers[passes.order[i]];
 
-	// Initialize HUD overlay shader if needed
-	if (show_hud) {
-		// Determine GLSL version for FPS shader
-		char *fps_vs_src, *fps_fs_src;
-		if (strlen(version) > 0) {
-			char *invalid;
-			long v = strtol(version, &invalid, 10);
-			bool is_glsl_3 = (invalid != version && v >= 300);
-			
-			if (is_glsl_3) {
-				asprintf(&fps_vs_src, "#version %s\nin vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n", version);
-				asprintf(&fps_fs_src, "#version %s\nprecision mediump float;\nout vec4 fragColor;\nvoid main() { fragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n", version);
-			} else {
-				asprintf(&fps_vs_src, "#version %s\nattribute vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n", version);
-				asprintf(&fps_fs_src, "#version %s\nprecision mediump float;\nvoid main() { gl_FragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n", version);
-			}
-		} else {
-			asprintf(&fps_vs_src, "attribute vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n");
-			asprintf(&fps_fs_src, "precision mediump float;\nvoid main() { gl_FragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n");
-		}
-		
-		ret = create_program(fps_vs_src, fps_fs_src);
-		if (ret < 0) {
-			printf("Warning: failed to create HUD shader, HUD display will be disabled\n");
-			show_hud = false;
-		} else {
-			fps_program = ret;
-			ret = link_program(fps_program);
-			if (ret) {
-				printf("Warning: failed to link HUD shader, HUD display will be disabled\n");
-				show_hud = false;
-				fps_program = 0;
-			} else {
-				// Create VBO for HUD text
-				glGenBuffers(1, &fps_vbo);
-			}
-		}
-		
-#ifdef HAVE_NVML
-		// Initialize NVML for GPU power monitoring
-		if (nvmlInit() == NVML_SUCCESS) {
-			if (nvmlDeviceGetHandleByIndex(0, &nvml_device) == NVML_SUCCESS) {
-				nvml_available = true;
-				printf("NVML initialized for GPU power monitoring\n");
-			} else {
-				printf("Warning: NVML available but could not get GPU handle\n");
-				nvmlShutdown();
-			}
-		} else {
-			printf("Warning: NVML initialization failed, power monitoring disabled\n");
-		}
-#endif
+		// Render to the other framebuffer, so that the buffer can read its previous result
+		glBindFramebuffer(GL_FRAMEBUFFER, buffer->fbs[!buffer->latest].fb);
+		glViewport(0, 0, buffer->pass.width, buffer->pass.height);
+		bind_channels(buffer->channels);
+
+		render_shadertoy(&buffer->pass);
+
+		buffer->latest = !buffer->latest;
 	}
 
-	egl->draw = draw_shadertoy;
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, screen_width, screen_height);
+	bind_channels(passes.channels);
+}
+
+static void draw_crossfade(void) {
+	float progress = (get_time_ns() - crossfade.start_time) / (crossfade.duration * NSEC_PER_SEC);
+	GLint target;
+
+	if (progress >= 1.0f) {
+		glDeleteProgram(previous.program);
+		previous.program = 0;
+		render_shadertoy(&current);
+		return;
+	}
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, crossfade.fbs[0].fb);
+	render_shadertoy(&previous);
+	glBindFramebuffer(GL_FRAMEBUFFER, crossfade.fbs[1].fb);
+	render_shadertoy(&current);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glUseProgram(crossfade.program);
+	glUniform1f(crossfade.progress, progress);
+	for (int i = 0; i < 2; i++) {
+		glActiveTexture(GL_TEXTURE0 + crossfade.units[i]);
+		glBindTexture(GL_TEXTURE_2D, crossfade.fbs[i].tex);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	glUseProgram(current.program);
+}
+
+/* Render the image pass into the targets of the reduced shading rate mode,
+ * and resolve them to the bound framebuffer.
+ */
+static void render_reduced(const struct shadertoy *pass, unsigned frame) {
+	GLint target;
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+
+	shading_rate->begin(pass->program, frame, builtins.mouse);
+	begin_gpu_timer(image_timer);
+	for (unsigned i = 0; shading_rate->draw(pass->program, i); i++) {
+		render_shadertoy(pass);
+	}
+	end_gpu_timer(image_timer);
+	shading_rate->resolve(target);
+
+	glViewport(0, 0, screen_width, screen_height);
+	glUseProgram(pass->program);
+}
+
+static void render_image(const struct shadertoy *pass, unsigned frame) {
+	if (shading_rate) {
+		render_reduced(pass, frame);
+	} else {
+		begin_gpu_timer(image_timer);
+		render_shadertoy(pass);
+		end_gpu_timer(image_timer);
+	}
+}
+
+/* Present the blend of the last two renders, from the older to the latest */
+static void present_interpolation(float progress) {
+	// The first render is presented as is
+	if (interpolation.renders < 2) {
+		progress = 1.0f;
+	}
+
+	glUseProgram(interpolation.program);
+	glUniform1f(interpolation.progress, progress);
+	for (int i = 0; i < 2; i++) {
+		glActiveTexture(GL_TEXTURE0 + interpolation.units[i]);
+		glBindTexture(GL_TEXTURE_2D, interpolation.fbs[interpolation.latest ^ 1 ^ i].tex);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	glUseProgram(current.program);
+}
+
+static void present_shadertoy(float progress, float fps) {
+	present_interpolation(progress);
+
+	draw_fps_counter(fps);
+}
+
+static bool reload_pending(void) {
+	return reload_job && compile_job_status(reload_job) != COMPILE_PENDING;
+}
+
+static void full_rect(int rect[4]) {
+	rect[0] = rect[1] = 0;
+	rect[2] = screen_width;
+	rect[3] = screen_height;
+}
+
+/* The region of the next frame that differs from the presented one, or false
+ * when the frame does not change at all.
+ */
+static bool damage_shadertoy(int rect[4]) {
+	bool changed = !still.presented || still.animated || onRenderCallbacks.length ||
+	               playing || governed || previous.program ||
+	               current.program != still.program || reload_pending() ||
+	               (still.interactive && memcmp(still.mouse, builtins.mouse, sizeof(still.mouse)));
+
+	if (changed) {
+		full_rect(rect);
+	} else if (show_hud && fps_program) {
+		hud_rect(rect);
+	} else {
+		return false;
+	}
+
+	memcpy(still.rect, rect, sizeof(still.rect));
+
+	return true;
+}
+
+/* Restrict the rendering to the damage of the frames since the content of
+ * the back buffer, by its age, and returns whether it's partial.
+ */
+static bool begin_repaint(void) {
+	const struct egl *egl = still.egl;
+	EGLint age = 0;
+	int rect[4];
+
+	if (egl->surface != EGL_NO_SURFACE && egl->buffer_age_supported) {
+		eglQuerySurface(egl->display, egl->surface, EGL_BUFFER_AGE_EXT, &age);
+	}
+
+	// The damage can only be repainted alone in the bound framebuffer
+	bool scissor = !shading_rate && !interpolation.enabled;
+
+	memcpy(rect, still.rect, sizeof(rect));
+	if (age < 1 || age > MAX_BUFFER_AGE || !scissor) {
+		full_rect(rect);
+	}
+	for (int i = 0; i < age - 1; i++) {
+		int x2 = MAX2(rect[0] + rect[2], still.history[i][0] + still.history[i][2]);
+		int y2 = MAX2(rect[1] + rect[3], still.history[i][1] + still.history[i][3]);
+
+		rect[0] = MIN2(rect[0], still.history[i][0]);
+		rect[1] = MIN2(rect[1], still.history[i][1]);
+		rect[2] = x2 - rect[0];
+		rect[3] = y2 - rect[1];
+	}
+
+	memmove(still.history[1], still.history[0], sizeof(still.history[0]) * (MAX_BUFFER_AGE - 1));
+	memcpy(still.history[0], still.rect, sizeof(still.history[0]));
+
+	if (egl->surface != EGL_NO_SURFACE && egl->eglSetDamageRegionKHR) {
+		egl->eglSetDamageRegionKHR(egl->display, egl->surface, rect, 1);
+	}
+
+	if (rect[2] == (int) screen_width && rect[3] == (int) screen_height) {
+		return false;
+	}
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(rect[0], rect[1], rect[2], rect[3]);
+
+	return true;
+}
+
+static void draw_shadertoy(uint64_t start_time, unsigned frame, float fps) {
+	const char *file;
+	GLuint program;
+	GLint target;
+	bool partial = false;
+
+	reload_shadertoy();
+
+	if (playing && update_playlist(get_time_ns(), &program, &file)) {
+		switch_shadertoy(program, file, get_time_ns(), frame);
+	}
+
+	if (governed && update_quality(get_time_ns(), &program)) {
+		use_shadertoy(program);
+	}
+
+	// Inputs are only bound to the shown program
+	glUseProgram(current.program);
+	float time = pass_time(&current, start_time, get_time_ns());
+	for (uint i = 0; i < onRenderCallbacks.length; i++) {
+		((onRenderCallback) onRenderCallbacks.callbacks[i])(frame, time);
+	}
+
+	update_builtins(start_time, frame, fps);
+
+	if (still.enabled) {
+		partial = begin_repaint();
+	}
+
+	start_perfcntrs();
+
+	render_buffers();
+
+	// Keep the last two renders, to blend between them
+	if (interpolation.enabled) {
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+		interpolation.latest ^= 1;
+		interpolation.renders++;
+		glBindFramebuffer(GL_FRAMEBUFFER, interpolation.fbs[interpolation.latest].fb);
+	}
+
+	if (previous.program) {
+		draw_crossfade();
+	} else {
+		render_image(&current, frame);
+	}
+
+	if (interpolation.enabled) {
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		present_interpolation(0.0f);
+	}
+
+	end_perfcntrs();
+	
+	// Draw FPS counter overlay after main shader
+	draw_fps_counter(fps);
+
+	if (partial) {
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	if (still.enabled) {
+		still.presented = true;
+		still.program = current.program;
+		memcpy(still.mouse, builtins.mouse, sizeof(still.mouse));
+	}
+}
+
+/* Renders a horizontal slice of the image, for beam racing. The inputs, and
+ * the buffer passes, are only updated with the first slice of the frame.
+ */
+static void draw_shadertoy_slice(uint64_t start_time, unsigned frame, float fps, int y, int height) {
+	if (y == 0) {
+		reload_shadertoy();
+
+		glUseProgram(current.program);
+		float time = pass_time(&current, start_time, get_time_ns());
+		for (uint i = 0; i < onRenderCallbacks.length; i++) {
+			((onRenderCallback) onRenderCallbacks.callbacks[i])(frame, time);
+		}
+
+		update_builtins(start_time, frame, fps);
+
+		render_buffers();
+	}
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, y, screen_width, height);
+
+	begin_gpu_timer(image_timer);
+	render_shadertoy(&current);
+	end_gpu_timer(image_timer);
+
+	draw_fps_counter(fps);
+
+	glDisable(GL_SCISSOR_TEST);
+}
+
+static int init_crossfade(float duration) {
+	int ret;
+
+	ret = create_quad_program(crossfade_fs);
+	if (ret < 0) {
+		return -1;
+	}
+	crossfade.program = ret;
+
+	for (int i = 0; i < 2; i++) {
+		if (!create_offscreen_framebuffer(&crossfade.fbs[i], screen_width, screen_height,
+		                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE)) {
+			return -1;
+		}
+	}
+
+	crossfade.units[0] = reserve_texture_unit();
+	crossfade.units[1] = reserve_texture_unit();
+
+	glUseProgram(crossfade.program);
+	glUniform1i(glGetUniformLocation(crossfade.program, "from"), crossfade.units[0]);
+	glUniform1i(glGetUniformLocation(crossfade.program, "to"), crossfade.units[1]);
+	crossfade.progress = glGetUniformLocation(crossfade.program, "progress");
+
+	crossfade.duration = duration;
+
+	return 0;
+}
+
+static int init_interpolation(void) {
+	int ret;
+
+	ret = create_quad_program(crossfade_fs);
+	if (ret < 0) {
+		return -1;
+	}
+	interpolation.program = ret;
+
+	for (int i = 0; i < 2; i++) {
+		if (!create_offscreen_framebuffer(&interpolation.fbs[i], screen_width, screen_height,
+		                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE)) {
+			return -1;
+		}
+	}
+
+	interpolation.units[0] = reserve_texture_unit();
+	interpolation.units[1] = reserve_texture_unit();
+
+	glUseProgram(interpolation.program);
+	glUniform1i(glGetUniformLocation(interpolation.program, "from"), interpolation.units[0]);
+	glUniform1i(glGetUniformLocation(interpolation.program, "to"), interpolation.units[1]);
+	interpolation.progress = glGetUniformLocation(interpolation.program, "progress");
+
+	interpolation.enabled = true;
+
+	return 0;
+}
+
+/* Detect the GLSL version, to generate the matching version directive */
+static int init_glsl_version(void) {
+	if (glsl_version_str)
+		return 0;
+
+	glsl_version_str = glsl_version();
+	if (strlen(glsl_version_str) > 0) {
+		char *invalid;
+		long v = strtol(glsl_version_str, &invalid, 10);
+		if (invalid == glsl_version_str) {
+			printf("failed to parse detected GLSL version: %s\n", invalid);
+			return -1;
+		}
+		asprintf(&version_directive, "#version %s", glsl_version_str);
+		printf("Using GLSL version directive: %s\n", version_directive);
+
+		is_glsl_3 = v >= 300;
+		has_compute = v >= 310;
+	} else {
+		version_directive = "";
+	}
+
+	return 0;
+}
+
+/* Return the length of the name of the macro defined by the line, if any */
+static size_t define_name_length(const char *line, const char **name) {
+	const char *ptr = line;
+
+	while (*ptr == ' ' || *ptr == '\t')
+		ptr++;
+	if (*ptr++ != '#')
+		return 0;
+	while (*ptr == ' ' || *ptr == '\t')
+		ptr++;
+	if (strncmp(ptr, "define", 6) != 0)
+		return 0;
+	ptr += 6;
+	if (*ptr != ' ' && *ptr != '\t')
+		return 0;
+	while (*ptr == ' ' || *ptr == '\t')
+		ptr++;
+
+	*name = ptr;
+	while (*ptr == '_' || isalnum(*ptr))
+		ptr++;
+
+	return ptr - *name;
+}
+
+/* Override the #define directives of the shader with the NAME=VALUE
+ * definitions, prepending those the shader does not define.
+ */
+static char *apply_defines(const char *shader, const char *const *defines) {
+	bool applied[MAX_DEFINES] = {false};
+	char *body, *result, *prepended = strdup("");
+	size_t size;
+	FILE *f;
+
+	f = open_memstream(&body, &size);
+	for (const char *line = shader; *line;) {
+		const char *end = strchrnul(line, '\n');
+		const char *name;
+		size_t len = define_name_length(line, &name);
+		bool overridden = false;
+
+		for (int i = 0; len && i < MAX_DEFINES && defines[i]; i++) {
+			const char *define = defines[i];
+			if (strncmp(define, name, len) == 0 && define[len] == '=') {
+				fprintf(f, "#define %.*s %s", (int) len, name, define + len + 1);
+				applied[i] = overridden = true;
+				break;
+			}
+		}
+		if (!overridden) {
+			fwrite(line, 1, end - line, f);
+		}
+
+		if (*end) {
+			fputc('\n', f);
+			end++;
+		}
+		line = end;
+	}
+	fclose(f);
+
+	for (int i = 0; i < MAX_DEFINES && defines[i]; i++) {
+		if (!applied[i]) {
+			const char *define = defines[i];
+			const char *value = strchr(define, '=');
+			char *prev = prepended;
+			asprintf(&prepended, "%s#define %.*s %s\n", prev, (int) (value - define), define, value + 1);
+			free(prev);
+		}
+	}
+
+	asprintf(&result, "%s%s", prepended, body);
+	free(prepended);
+	free(body);
+
+	return result;
+}
+
+static void generate_shadertoy(const char *shader, const char *declarations, enum precision precision,
+                               char **vs, char **fs) {
+	char *body = specialization.defines ? apply_defines(shader, specialization.defines) : strdup(shader);
+
+	asprintf(vs, is_glsl_3 ? shadertoy_vs_tmpl_300 : shadertoy_vs_tmpl_100, version_directive);
+	asprintf(fs, is_glsl_3 ? shadertoy_fs_tmpl_300 : shadertoy_fs_tmpl_100, version_directive,
+	         precision_statements[precision], declarations, body);
+
+	free(body);
+}
+
+/* Build the program for the given shader, from the program cache if possible */
+static int build_shadertoy(const char *shader, const char *declarations, enum precision precision) {
+	char *shadertoy_vs, *shadertoy_fs;
+	uint64_t start_time;
+	bool hit;
+	int ret;
+
+	generate_shadertoy(shader, declarations, precision, &shadertoy_vs, &shadertoy_fs);
+
+	start_time = get_time_ns();
+	ret = create_cached_program(shadertoy_vs, shadertoy_fs, &hit);
+
+	free(shadertoy_vs);
+	free(shadertoy_fs);
+
+	if (ret < 0) {
+		return -1;
+	}
+
+	printf("Program ready in %.1f ms (%s)\n",
+	       (get_time_ns() - start_time) / (double) (NSEC_PER_SEC / MSEC_PER_SEC),
+	       hit ? "cached binary" : "compiled from source");
+
+	return ret;
+}
+
+/* Find the inputs read by the image pass, from the active uniforms of a
+ * probe program, where they are redirected to uniforms of their own.
+ */
+static int init_still(const char *shader, const struct egl *egl) {
+	char *declarations = strdup(passes.declarations), *vs, *fs;
+	int program;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(probed_inputs); i++) {
+		char *prev = declarations;
+		// Inputs specialized as constants are left as is
+		asprintf(&declarations, "%s#ifndef %s\nuniform %s kms_probe_%s;\n#define %s kms_probe_%s\n#endif\n",
+		         prev, probed_inputs[i].name, probed_inputs[i].type, probed_inputs[i].name,
+		         probed_inputs[i].name, probed_inputs[i].name);
+		free(prev);
+	}
+
+	generate_shadertoy(shader, declarations, PRECISION_HIGHP, &vs, &fs);
+	free(declarations);
+
+	program = create_program(vs, fs);
+	free(vs);
+	free(fs);
+	if (program < 0) {
+		return -1;
+	}
+	if (link_program(program)) {
+		glDeleteProgram(program);
+		return -1;
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(probed_inputs); i++) {
+		char *name;
+
+		asprintf(&name, "kms_probe_%s", probed_inputs[i].name);
+		if (glGetUniformLocation(program, name) >= 0) {
+			if (strcmp(probed_inputs[i].name, "iMouse") == 0) {
+				still.interactive = true;
+			} else {
+				still.animated = true;
+			}
+		}
+		free(name);
+	}
+	glDeleteProgram(program);
+
+	// Buffers, and the temporal modes, change on each frame
+	still.animated |= passes.count || (shading_rate && shading_rate->temporal);
+	still.egl = egl;
+	still.enabled = true;
+
+	if (still.animated) {
+		printf("Shader is animated, rendering every frame\n");
+	} else {
+		printf("Shader is static%s, rendering on changes only\n",
+		       still.interactive ? " but for iMouse" : "");
+	}
+
+	return 0;
+}
+
+/* The key of the cache records of the image pass, i.e. its generated source */
+static char *record_key(const char *shader) {
+	char *vs, *fs;
+
+	generate_shadertoy(shader, passes.declarations, PRECISION_HIGHP, &vs, &fs);
+	free(vs);
+
+	return fs;
+}
+
+/* Look up the precision persisted by the calibration of the shader */
+static bool load_precision(const char *shader, enum precision *precision) {
+	char *key = record_key(shader), value[16];
+	bool found = false;
+
+	if (!load_cache_record("precision", key, value, sizeof(value))) {
+		for (enum precision p = PRECISION_HIGHP; p < PRECISION_AUTO; p++) {
+			if (!strcmp(value, precision_names[p])) {
+				*precision = p;
+				found = true;
+			}
+		}
+	}
+	free(key);
+
+	return found;
+}
+
+static void store_precision(const char *shader, enum precision precision) {
+	char *key = record_key(shader);
+
+	store_cache_record("precision", key, precision_names[precision]);
+	free(key);
+}
+
+/* Precision of the image pass, that's highp in auto mode until calibrated */
+static enum precision image_precision(const char *shader) {
+	enum precision precision = precision_mode;
+
+	if (precision == PRECISION_AUTO && !load_precision(shader, &precision)) {
+		precision = PRECISION_HIGHP;
+	}
+
+	return precision;
+}
+
+/* Build the program for the given shader file in the background */
+struct compile_job *compile_shadertoy(const char *file) {
+	char *shader, *vs, *fs;
+
+	shader = read_shader(file);
+	if (!shader) {
+		return NULL;
+	}
+
+	generate_shadertoy(shader, passes.declarations, image_precision(shader), &vs, &fs);
+	free(shader);
+
+	return compile_async(vs, fs);
+}
+
+/* Build a variant of the shader with the NAME=VALUE definitions in the background */
+struct compile_job *compile_shadertoy_variant(const char *shader, const char *const *defines) {
+	char *variant, *vs, *fs;
+
+	variant = apply_defines(shader, defines);
+	generate_shadertoy(variant, passes.declarations, image_precision(variant), &vs, &fs);
+	free(variant);
+
+	return compile_async(vs, fs);
+}
+
+/* Called from the event loop, when the shader file has changed */
+static void shader_changed(const char *file, void *data) {
+	(void) data;
+
+	struct compile_job *job = compile_shadertoy(file);
+	if (!job) {
+		return;
+	}
+
+	if (reload_job) {
+		// Superseded by the latest change
+		free_compile_job(reload_job);
+	}
+	reload_job = job;
+}
+
+/* Build the programs of the shaders in dir, as the run with the same
+ * --precision and --define options looks them up.
+ */
+int precompile_shadertoys(const char *dir, const struct options *options) {
+	struct dirent **entries;
+	int n, failures = 0;
+
+	if (init_glsl_version()) {
+		return -1;
+	}
+
+	precision_mode = options->precision;
+	specialization.defines = options->defines[0] ? options->defines : NULL;
+	passes.declarations = strdup("");
+
+	n = scandir(dir, &entries, NULL, alphasort);
+	if (n < 0) {
+		printf("could not open directory '%s': %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	uint64_t start_time = get_time_ns();
+
+	for (int i = 0; i < n; i++) {
+		const char *name = entries[i]->d_name;
+		size_t len = strlen(name);
+
+		if (len > 5 && strcmp(&name[len - 5], ".glsl") == 0) {
+			char *file;
+			asprintf(&file, "%s/%s", dir, name);
+			printf("Precompiling %s\n", file);
+
+			char *shader = read_shader(file);
+			int program = shader ? 0 : -1;
+
+			for (enum precision p = PRECISION_HIGHP; shader && p < PRECISION_AUTO; p++) {
+				enum precision precision = image_precision(shader);
+				// Auto precision calibrates with both variants, unless it already did
+				bool calibrate = precision_mode == PRECISION_AUTO && !load_precision(shader, &precision);
+
+				if (p != precision && !calibrate) {
+					continue;
+				}
+				program = build_shadertoy(shader, passes.declarations, p);
+				if (program < 0) {
+					break;
+				}
+				glDeleteProgram(program);
+			}
+			free(shader);
+			if (program < 0) {
+				printf("failed to build program for %s\n", file);
+				failures++;
+			}
+			free(file);
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	printf("Precompiled %s in %.1f ms, %d failure(s)\n", dir,
+	       (get_time_ns() - start_time) / (double) (NSEC_PER_SEC / MSEC_PER_SEC),
+	       failures);
+
+	return failures ? -1 : 0;
+}
+
+/* Declare the samplers of the channels bound to buffers, and with
+ * specialization, the built-in inputs that are known at compile time as
+ * constants, so that they can be folded.
+ */
+static char *declare_pass(const char channels[NUM_CHANNELS], int width, int height) {
+	char *declarations;
+	size_t size;
+	FILE *f;
+
+	f = open_memstream(&declarations, &size);
+
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		if (channels[i]) {
+			fprintf(f, "uniform sampler2D iChannel%d;\n", i);
+		}
+	}
+
+	if (specialization.enabled) {
+		fprintf(f, "const vec3 kms_iResolution = vec3(%d.0, %d.0, 1.0);\n"
+		           "#define iResolution kms_iResolution\n", width, height);
+
+		// Constant arrays are not supported by GLSL ES 1.00
+		if (is_glsl_3) {
+			fprintf(f, "const vec3 kms_iChannelResolution[4] = vec3[4](");
+			for (int i = 0; i < NUM_CHANNELS; i++) {
+				const struct shadertoy *buffer = channels[i] ? &passes.buffers[channels[i] - 'A'].pass : NULL;
+				fprintf(f, "%svec3(%d.0, %d.0, %s)", i ? ", " : "",
+				        buffer ? buffer->width : 0, buffer ? buffer->height : 0, buffer ? "1.0" : "0.0");
+			}
+			fprintf(f, ");\n"
+			           "#define iChannelResolution kms_iChannelResolution\n");
+		}
+
+		if (specialization.mouse) {
+			fprintf(f, "const vec4 kms_iMouse = vec4(0.0);\n"
+			           "#define iMouse kms_iMouse\n");
+		}
+	}
+
+	fclose(f);
+
+	return declarations;
+}
+
+static int parse_channel(const char *spec, char channels[NUM_CHANNELS], unsigned count) {
+	unsigned channel;
+	char buffer;
+
+	if (sscanf(spec, "iChannel%u=%c", &channel, &buffer) != 2 ||
+	    channel >= NUM_CHANNELS || buffer < 'A' || buffer >= (char) ('A' + count)) {
+		printf("invalid channel '%s', expected iChannel[0-%d]=[A-%c]\n", spec,
+		       NUM_CHANNELS - 1, 'A' + count - 1);
+		return -1;
+	}
+	channels[channel] = buffer;
+
+	return 0;
+}
+
+/* Parse FILE[:format=rgba8|rgba16f][:scale=S][:iChannelN=X]... */
+static int parse_buffer(const char *spec, struct buffer *buffer, unsigned count,
+                        char **file, bool *half_float) {
+	char *str = strdup(spec), *saveptr, *token;
+	float scale = 1.0f;
+	int ret = -1;
+
+	*file = NULL;
+	*half_float = false;
+
+	token = strtok_r(str, ":", &saveptr);
+	if (!token) {
+		goto out;
+	}
+	*file = strdup(token);
+
+	while ((token = strtok_r(NULL, ":", &saveptr))) {
+		if (strcmp(token, "format=rgba8") == 0) {
+			*half_float = false;
+		} else if (strcmp(token, "format=rgba16f") == 0) {
+			*half_float = true;
+		} else if (strncmp(token, "scale=", 6) == 0) {
+			scale = strtof(token + 6, NULL);
+			if (scale <= 0.0f || scale > 1.0f) {
+				printf("invalid buffer scale '%s'\n", token + 6);
+				goto out;
+			}
+		} else if (strncmp(token, "iChannel", 8) == 0) {
+			if (parse_channel(token, buffer->channels, count)) {
+				goto out;
+			}
+		} else {
+			printf("invalid buffer option '%s'\n", token);
+			goto out;
+		}
+	}
+
+	buffer->pass.width = MAX2(1, screen_width * scale);
+	buffer->pass.height = MAX2(1, screen_height * scale);
+	ret = 0;
+
+out:
+	free(str);
+	return ret;
+}
+
+static void sort_buffer(unsigned index, unsigned char *state, unsigned *count) {
+	const struct buffer *buffer = &passes.buffers[index];
+
+	state[index] = 1;
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		unsigned dependency = buffer->channels[i] - 'A';
+		// A cycle reads the previous frame of the buffer it goes back to
+		if (buffer->channels[i] && state[dependency] == 0) {
+			sort_buffer(dependency, state, count);
+		}
+	}
+	state[index] = 2;
+
+	passes.order[(*count)++] = index;
+}
+
+static int init_buffers(const struct options *options) {
+	unsigned char state[MAX_PASS_BUFFERS] = {0};
+	unsigned count = 0;
+
+	while (count < MAX_PASS_BUFFERS && options->buffers[count]) {
+		count++;
+	}
+
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		char channel = options->channels[i];
+		if (channel && (channel < 'A' || channel >= (char) ('A' + count))) {
+			printf("iChannel%d refers to undefined buffer %c\n", i, channel);
+			return -1;
+		}
+		passes.channels[i] = channel;
+	}
+
+	if (!count) {
+		passes.declarations = declare_pass(passes.channels, screen_width, screen_height);
+		return 0;
+	}
+
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		passes.units[i] = reserve_texture_unit();
+	}
+
+	// Parse all the buffers first, as their resolutions are declared to the passes reading them
+	char *files[MAX_PASS_BUFFERS] = {NULL};
+	bool half_float[MAX_PASS_BUFFERS];
+	for (unsigned i = 0; i < count; i++) {
+		if (parse_buffer(options->buffers[i], &passes.buffers[i], count, &files[i], &half_float[i])) {
+			goto fail;
+		}
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		struct buffer *buffer = &passes.buffers[i];
+		char *shader, *declarations;
+		int ret;
+
+		shader = read_shader(files[i]);
+		if (!shader) {
+			goto fail;
+		}
+
+		printf("Building buffer %c from %s\n", 'A' + i, files[i]);
+
+		declarations = declare_pass(buffer->channels, buffer->pass.width, buffer->pass.height);
+		ret = build_shadertoy(shader, declarations, PRECISION_HIGHP);
+		free(declarations);
+		free(shader);
+		if (ret < 0) {
+			printf("failed to create program for buffer %c\n", 'A' + i);
+			goto fail;
+		}
+
+		glUseProgram(ret);
+		init_pass(&buffer->pass, ret, SLOT_BUFFER(i), buffer->pass.width, buffer->pass.height,
+		          buffer->channels);
+		set_channel_samplers(ret, buffer->channels);
+
+		for (int j = 0; j < 2; j++) {
+			bool created;
+			if (half_float[i]) {
+				created = is_glsl_3 ?
+				          create_offscreen_framebuffer(&buffer->fbs[j], buffer->pass.width, buffer->pass.height,
+				                                       GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT) :
+				          create_offscreen_framebuffer(&buffer->fbs[j], buffer->pass.width, buffer->pass.height,
+				                                       GL_RGBA, GL_RGBA, GL_HALF_FLOAT_OES);
+			} else {
+				created = create_offscreen_framebuffer(&buffer->fbs[j], buffer->pass.width, buffer->pass.height,
+				                                       GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE);
+			}
+			if (!created) {
+				printf("failed to create framebuffer for buffer %c\n", 'A' + i);
+				goto fail;
+			}
+
+			// Buffers start out cleared
+			glBindFramebuffer(GL_FRAMEBUFFER, buffer->fbs[j].fb);
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	passes.count = count;
+
+	unsigned sorted = 0;
+	for (unsigned i = 0; i < count; i++) {
+		if (state[i] == 0) {
+			sort_buffer(i, state, &sorted);
+		}
+	}
+
+	passes.declarations = declare_pass(passes.channels, screen_width, screen_height);
+
+	for (unsigned i = 0; i < count; i++) {
+		free(files[i]);
+	}
+
+	return 0;
+
+fail:
+	for (unsigned i = 0; i < count; i++) {
+		free(files[i]);
+	}
+	return -1;
+}
+
+/* Render a pass with fixed inputs, for calibration and benchmarks */
+static void render_offscreen_pass(const struct shadertoy *pass, uint64_t start_time, uint64_t time,
+                                  unsigned frame) {
+	static const GLfloat date[4] = {0};
+
+	update_pass_inputs(pass, start_time, time, frame, 0.0f, 0.0f, date);
+	if (is_glsl_3) {
+		glBindBuffer(GL_UNIFORM_BUFFER, builtins.ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, pass->slot * builtins.stride,
+		                sizeof(struct shadertoy_inputs), pass_inputs(pass));
+	}
+	render_shadertoy(pass);
+}
+
+#define BENCHMARK_ROUNDS 10
+
+/* Compare the generic and specialized programs of the image pass, rendering
+ * them offscreen in alternating rounds, to even out clock and thermal drift.
+ */
+int benchmark_specialization(const char *file, unsigned frames) {
+	static const char *variants[] = {"generic", "specialized"};
+	struct shadertoy passes_ab[2] = {0};
+	uint64_t elapsed[2] = {0, 0};
+	struct framebuffer fb;
+	bool enabled = specialization.enabled;
+	char *shader;
+	int ret = -1;
+
+	if (frames < BENCHMARK_ROUNDS) {
+		frames = BENCHMARK_ROUNDS;
+	}
+
+	shader = read_shader(file);
+	if (!shader) {
+		return -1;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		specialization.enabled = i == 1;
+		char *declarations = declare_pass(passes.channels, screen_width, screen_height);
+		int program = build_shadertoy(shader, declarations, image_precision(shader));
+		free(declarations);
+		if (program < 0) {
+			printf("failed to build the %s program\n", variants[i]);
+			goto out;
+		}
+
+		glUseProgram(program);
+		init_pass(&passes_ab[i], program, i ? SLOT_PREVIOUS : SLOT_CURRENT,
+		          screen_width, screen_height, passes.channels);
+		set_channel_samplers(program, passes.channels);
+	}
+
+	if (!create_offscreen_framebuffer(&fb, screen_width, screen_height,
+	                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE)) {
+		goto out;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, fb.fb);
+	glViewport(0, 0, screen_width, screen_height);
+
+	uint64_t start_time = get_time_ns();
+	unsigned frame = 0;
+
+	for (unsigned round = 0; round < BENCHMARK_ROUNDS; round++) {
+		for (int i = 0; i < 2; i++) {
+			uint64_t round_start = get_time_ns();
+
+			for (unsigned n = 0; n < frames / BENCHMARK_ROUNDS; n++) {
+				render_offscreen_pass(&passes_ab[i], start_time, get_time_ns(), frame++);
+			}
+			glFinish();
+
+			elapsed[i] += get_time_ns() - round_start;
+		}
+	}
+
+	unsigned n = frames / BENCHMARK_ROUNDS * BENCHMARK_ROUNDS;
+	for (int i = 0; i < 2; i++) {
+		printf("%s: %u frames in %f sec (%.3f ms/frame)\n", variants[i], n,
+		       elapsed[i] / (double) NSEC_PER_SEC,
+		       elapsed[i] / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / n);
+	}
+	printf("Specialization speedup for %s: %.2fx\n", file, (double) elapsed[0] / elapsed[1]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fb.fb);
+	glDeleteTextures(1, &fb.tex);
+
+	ret = 0;
+
+out:
+	for (int i = 0; i < 2; i++) {
+		if (passes_ab[i].program) {
+			glDeleteProgram(passes_ab[i].program);
+		}
+	}
+	specialization.enabled = enabled;
+	free(shader);
+
+	return ret;
+}
+
+#define CALIBRATION_ROUNDS 4
+#define CALIBRATION_FRAMES 15
+// Pixels with a channel differing by more than the threshold are incorrect
+#define CALIBRATION_THRESHOLD 8
+// Fraction of incorrect pixels tolerated for mediump
+#define CALIBRATION_TOLERANCE 0.01
+// Speedup required for mediump, not to trade accuracy for noise
+#define CALIBRATION_MIN_SPEEDUP 1.05
+
+static bool has_distinct_mediump(void) {
+	GLint range[2], highp, mediump;
+
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &highp);
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_MEDIUM_FLOAT, range, &mediump);
+
+	// Without highp support, the highp variant falls back to mediump
+	return highp > 0 && mediump < highp;
+}
+
+static unsigned count_differing_pixels(const GLubyte *a, const GLubyte *b, size_t pixels) {
+	unsigned count = 0;
+
+	for (size_t i = 0; i < pixels * 4; i += 4) {
+		for (int c = 0; c < 4; c++) {
+			if (abs(a[i + c] - b[i + c]) > CALIBRATION_THRESHOLD) {
+				count++;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Render the image pass with highp and mediump, comparing the output of
+ * a few frames, and timing them in alternating rounds, to select mediump
+ * only when it's both visually correct and faster.
+ */
+static enum precision calibrate_precision(const char *shader) {
+	// Spread over the first seconds, as many shaders only diverge over time
+	static const uint64_t sample_times[] = {0, NSEC_PER_SEC / 2, 3 * NSEC_PER_SEC, 20 * NSEC_PER_SEC};
+	const size_t num_samples = sizeof(sample_times) / sizeof(sample_times[0]);
+	const size_t pixels = (size_t) screen_width * screen_height;
+	struct shadertoy variants[2] = {0};
+	uint64_t elapsed[2] = {0, 0};
+	unsigned differing = 0;
+	enum precision selected = PRECISION_HIGHP;
+	struct framebuffer fb;
+	GLubyte *readback[2];
+
+	if (!has_distinct_mediump()) {
+		printf("mediump is no less precise than highp on this GPU, using highp\n");
+		return PRECISION_HIGHP;
+	}
+
+	printf("Calibrating precision...\n");
+
+	for (int i = 0; i < 2; i++) {
+		int program = build_shadertoy(shader, passes.declarations, i ? PRECISION_MEDIUMP : PRECISION_HIGHP);
+		if (program < 0) {
+			printf("failed to build the %s variant\n", precision_names[i ? PRECISION_MEDIUMP : PRECISION_HIGHP]);
+			goto out;
+		}
+
+		glUseProgram(program);
+		init_pass(&variants[i], program, i ? SLOT_PREVIOUS : SLOT_CURRENT,
+		          screen_width, screen_height, passes.channels);
+		set_channel_samplers(program, passes.channels);
+	}
+
+	if (!create_offscreen_framebuffer(&fb, screen_width, screen_height,
+	                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE)) {
+		goto out;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, fb.fb);
+	glViewport(0, 0, screen_width, screen_height);
+
+	readback[0] = malloc(pixels * 4);
+	readback[1] = malloc(pixels * 4);
+
+	for (size_t s = 0; s < num_samples; s++) {
+		for (int i = 0; i < 2; i++) {
+			render_offscreen_pass(&variants[i], 0, sample_times[s], s);
+			glReadPixels(0, 0, screen_width, screen_height, GL_RGBA, GL_UNSIGNED_BYTE, readback[i]);
+		}
+		differing += count_differing_pixels(readback[0], readback[1], pixels);
+	}
+
+	free(readback[0]);
+	free(readback[1]);
+
+	for (unsigned round = 0; round < CALIBRATION_ROUNDS; round++) {
+		for (int i = 0; i < 2; i++) {
+			uint64_t start_time = get_time_ns();
+
+			for (unsigned n = 0; n < CALIBRATION_FRAMES; n++) {
+				render_offscreen_pass(&variants[i], 0, n * NSEC_PER_SEC / 60, n);
+			}
+			glFinish();
+
+			elapsed[i] += get_time_ns() - start_time;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fb.fb);
+	glDeleteTextures(1, &fb.tex);
+
+	double error = differing / (double) (pixels * num_samples);
+	double speedup = elapsed[0] / (double) elapsed[1];
+	unsigned frames = CALIBRATION_ROUNDS * CALIBRATION_FRAMES;
+
+	if (error <= CALIBRATION_TOLERANCE && speedup >= CALIBRATION_MIN_SPEEDUP) {
+		selected = PRECISION_MEDIUMP;
+	}
+
+	printf("highp: %.3f ms/frame, mediump: %.3f ms/frame (%.2fx), %.2f%% of pixels differ, using %s\n",
+	       elapsed[0] / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / frames,
+	       elapsed[1] / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / frames,
+	       speedup, error * 100, precision_names[selected]);
+
+out:
+	for (int i = 0; i < 2; i++) {
+		if (variants[i].program) {
+			glDeleteProgram(variants[i].program);
+		}
+	}
+
+	return selected;
+}
+
+static int create_compute_program(const char *cs_src) {
+	GLuint shader, program;
+	GLint ret;
+
+	shader = glCreateShader(GL_COMPUTE_SHADER);
+	if (shader == 0) {
+		printf("compute shader creation failed!\n");
+		return -1;
+	}
+
+	glShaderSource(shader, 1, &cs_src, NULL);
+	glCompileShader(shader);
+
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ret);
+	if (!ret) {
+		char *log;
+
+		printf("compute shader compilation failed!:\n");
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &ret);
+		if (ret > 1) {
+			log = malloc(ret);
+			glGetShaderInfoLog(shader, ret, NULL, log);
+			printf("%s", log);
+			free(log);
+		}
+
+		glDeleteShader(shader);
+		return -1;
+	}
+
+	program = glCreateProgram();
+	glAttachShader(program, shader);
+	glDeleteShader(shader);
+
+	if (link_program(program)) {
+		glDeleteProgram(program);
+		return -1;
+	}
+
+	return program;
+}
+
+static int build_compute(const char *shader, enum precision precision, const GLuint local_size[2]) {
+	char *body = specialization.defines ? apply_defines(shader, specialization.defines) : strdup(shader);
+	char *cs;
+	int ret;
+
+	asprintf(&cs, shadertoy_cs_tmpl_310, version_directive, precision_statements[precision],
+	         local_size[0], local_size[1], passes.declarations, body);
+	free(body);
+
+	ret = create_compute_program(cs);
+	free(cs);
+
+	return ret;
+}
+
+#define TUNE_FRAMES 10
+
+/* Candidate workgroup sizes, the most commonly efficient first */
+static const GLuint workgroup_sizes[][2] = {
+		{8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 4}, {32, 8}, {64, 1},
+};
+
+/* Build the compute variant of the image pass, with the workgroup size that
+ * renders it the fastest, timed over a few frames for each candidate.
+ */
+static int tune_compute(const char *shader, enum precision precision) {
+	const unsigned num_sizes = sizeof(workgroup_sizes) / sizeof(workgroup_sizes[0]);
+	GLint max_invocations, max_size[2];
+	uint64_t best_time = UINT64_MAX;
+	int best = -1;
+	char *key, value[16];
+
+	key = record_key(shader);
+	if (!load_cache_record("workgroup", key, value, sizeof(value)) &&
+	    sscanf(value, "%ux%u", &compute.local_size[0], &compute.local_size[1]) == 2) {
+		printf("Using %ux%u workgroups, from the tuning\n", compute.local_size[0], compute.local_size[1]);
+		free(key);
+		return build_compute(shader, precision, compute.local_size);
+	}
+
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size[0]);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &max_size[1]);
+
+	printf("Tuning the compute workgroup size...\n");
+
+	for (unsigned i = 0; i < num_sizes; i++) {
+		const GLuint *size = workgroup_sizes[i];
+		struct shadertoy pass = {0};
+
+		if (size[0] * size[1] > (GLuint) max_invocations ||
+		    size[0] > (GLuint) max_size[0] || size[1] > (GLuint) max_size[1]) {
+			continue;
+		}
+
+		int program = build_compute(shader, precision, size);
+		if (program < 0) {
+			// Not a size issue, e.g. the shader uses fragment only built-ins
+			break;
+		}
+
+		glUseProgram(program);
+		init_pass(&pass, program, SLOT_CURRENT, screen_width, screen_height, passes.channels);
+		set_channel_samplers(program, passes.channels);
+		memcpy(pass.local_size, size, sizeof(pass.local_size));
+
+		// The first dispatch may include deferred compilation
+		render_offscreen_pass(&pass, 0, 0, 0);
+		glFinish();
+
+		uint64_t start_time = get_time_ns();
+		for (unsigned n = 0; n < TUNE_FRAMES; n++) {
+			render_offscreen_pass(&pass, 0, n * NSEC_PER_SEC / 60, n);
+		}
+		glFinish();
+		uint64_t elapsed = get_time_ns() - start_time;
+
+		printf("  %ux%u: %.3f ms/frame\n", size[0], size[1],
+		       elapsed / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / TUNE_FRAMES);
+
+		if (elapsed < best_time) {
+			if (best >= 0) {
+				glDeleteProgram(best);
+			}
+			best = program;
+			best_time = elapsed;
+			memcpy(compute.local_size, size, sizeof(compute.local_size));
+		} else {
+			glDeleteProgram(program);
+		}
+	}
+
+	if (best >= 0) {
+		snprintf(value, sizeof(value), "%ux%u", compute.local_size[0], compute.local_size[1]);
+		store_cache_record("workgroup", key, value);
+		printf("Using %s workgroups\n", value);
+	}
+	free(key);
+
+	return best;
+}
+
+/* Set up the compute path of the image pass, returning its program, or -1
+ * to fall back to the fragment path.
+ */
+static int init_compute(const char *shader, enum precision precision) {
+	if (!has_compute) {
+		printf("Compute shaders require OpenGL ES 3.1, using the fragment path\n");
+		return -1;
+	}
+
+	glGenTextures(1, &compute.tex);
+	glBindTexture(GL_TEXTURE_2D, compute.tex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, screen_width, screen_height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &compute.fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, compute.fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, compute.tex, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	int program = status == GL_FRAMEBUFFER_COMPLETE ? tune_compute(shader, precision) : -1;
+	if (program < 0) {
+		printf("Failed to set up the compute path, using the fragment path\n");
+		glDeleteFramebuffers(1, &compute.fb);
+		glDeleteTextures(1, &compute.tex);
+		return -1;
+	}
+
+	compute.enabled = true;
+
+	return program;
+}
+
+int init_shadertoy(const struct gbm *gbm, struct egl *egl, const char *file, const struct options *options) {
+	int ret;
+	
+	// Store settings
+	show_hud = options->show_hud;
+	screen_width = gbm->width;
+	screen_height = gbm->height;
+	
+	if (options->playlist) {
+		file = init_playlist(options->playlist);
+		if (!file || init_compiler(egl)) {
+			return -1;
+		}
+	}
+
+	set_shader_filename(file);
+
+	char *shader = read_shader(file);
+	if (!shader) {
+		return -1;
+	}
+
+	if (init_glsl_version()) {
+		free(shader);
+		return -1;
+	}
+	const char *version = glsl_version_str;
+
+	init_builtins();
+
+	glGenBuffers(1, &shadertoy_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, shadertoy_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), 0, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), &vertices[0]);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) (intptr_t) 0);
+	glEnableVertexAttribArray(0);
+
+	precision_mode = options->precision;
+
+	specialization.enabled = options->specialize;
+	specialization.mouse = onRenderCallbacks.length == 0;
+	specialization.defines = options->defines[0] ? options->defines : NULL;
+
+	// Buffers are set up before the inputs, not to disturb their texture bindings
+	if (init_buffers(options)) {
+		free(shader);
+		return -1;
+	}
+
+	init_gpu_timers(egl);
+	image_timer = create_gpu_timer("image pass");
+
+	if (options->checkerboard) {
+		shading_rate = init_checkerboard(screen_width, screen_height);
+		if (!shading_rate) {
+			printf("failed to initialize checkerboard rendering\n");
+			free(shader);
+			return -1;
+		}
+	} else if (options->taau > 0) {
+		shading_rate = init_taau(screen_width, screen_height, options->taau, is_glsl_3);
+		if (!shading_rate) {
+			printf("failed to initialize temporal upsampling\n");
+			free(shader);
+			return -1;
+		}
+	} else if (options->upscale > 0) {
+		shading_rate = init_upscale(screen_width, screen_height, options->upscale);
+		if (!shading_rate) {
+			printf("failed to initialize upscaling\n");
+			free(shader);
+			return -1;
+		}
+	} else if (options->foveate) {
+		shading_rate = init_foveation(screen_width, screen_height, options->foveate);
+		if (!shading_rate) {
+			printf("failed to initialize foveated rendering\n");
+			free(shader);
+			return -1;
+		}
+	}
+
+	if (shading_rate) {
+		char *declarations = passes.declarations;
+		asprintf(&passes.declarations, "%s%s", declarations, shading_rate->declarations);
+		free(declarations);
+	}
+
+	// The governor starts from the highest quality level
+	char *source = NULL;
+	if (options->target_fps > 0) {
+		int levels = init_quality(shader, options->target_fps);
+		if (levels < 0 || (levels > 0 && init_compiler(egl))) {
+			free(shader);
+			return -1;
+		}
+		if (levels > 0) {
+			governed = true;
+			source = shader;
+			shader = apply_defines(source, quality_defines(levels - 1));
+		}
+	}
+
+	enum precision precision = precision_mode;
+	if (precision == PRECISION_AUTO) {
+		if (load_precision(shader, &precision)) {
+			printf("Using %s precision, from the calibration\n", precision_names[precision]);
+		} else {
+			precision = calibrate_precision(shader);
+			store_precision(shader, precision);
+		}
+	}
+
+	ret = options->compute ? init_compute(shader, precision) : -1;
+	if (ret < 0) {
+		ret = build_shadertoy(shader, passes.declarations, precision);
+	}
+	if (ret >= 0 && options->skip_static && init_still(shader, egl)) {
+		printf("Warning: failed to detect static content, rendering every frame\n");
+	}
+	free(shader);
+	if (ret < 0) {
+		printf("failed to create program\n");
+		free(source);
+		return -1;
+	}
+
+	if (options->playlist && options->crossfade > 0 && init_crossfade(options->crossfade)) {
+		printf("Warning: failed to initialize crossfade, switching shaders directly\n");
+		crossfade.duration = 0;
+	}
+
+	if (options->interpolate && init_interpolation()) {
+		printf("Warning: failed to initialize interpolation, presenting the last render\n");
+	}
+
+	glViewport(0, 0, gbm->width, gbm->height);
+	use_shadertoy(ret);
+	if (compute.enabled) {
+		memcpy(current.local_size, compute.local_size, sizeof(current.local_size));
+	}
+
+	// Initialize HUD overlay shader if needed
+	if (show_hud) {
+		// Determine GLSL version for FPS shader
+		char *fps_vs_src, *fps_fs_src;
+		if (strlen(version) > 0) {
+			if (is_glsl_3) {
+				asprintf(&fps_vs_src, "#version %s\nin vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n", version);
+				asprintf(&fps_fs_src, "#version %s\nprecision mediump float;\nout vec4 fragColor;\nvoid main() { fragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n", version);
+			} else {
+				asprintf(&fps_vs_src, "#version %s\nattribute vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n", version);
+				asprintf(&fps_fs_src, "#version %s\nprecision mediump float;\nvoid main() { gl_FragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n", version);
+			}
+		} else {
+			asprintf(&fps_vs_src, "attribute vec2 position;\nvoid main() { gl_Position = vec4(position, 0.0, 1.0); }\n");
+			asprintf(&fps_fs_src, "precision mediump float;\nvoid main() { gl_FragColor = vec4(1.0, 1.0, 1.0, 1.0); }\n");
+		}
+		
+		ret = create_program(fps_vs_src, fps_fs_src);
+		if (ret < 0) {
+			printf("Warning: failed to create HUD shader, HUD display will be disabled\n");
+			show_hud = false;
+		} else {
+			fps_program = ret;
+			ret = link_program(fps_program);
+			if (ret) {
+				printf("Warning: failed to link HUD shader, HUD display will be disabled\n");
+				show_hud = false;
+				fps_program = 0;
+			} else {
+				// Create VBO for HUD text
+				glGenBuffers(1, &fps_vbo);
+			}
+		}
+		
+#ifdef HAVE_NVML
+		// Initialize NVML for GPU power monitoring
+		if (nvmlInit() == NVML_SUCCESS) {
+			if (nvmlDeviceGetHandleByIndex(0, &nvml_device) == NVML_SUCCESS) {
+				nvml_available = true;
+				printf("NVML initialized for GPU power monitoring\n");
+			} else {
+				printf("Warning: NVML available but could not get GPU handle\n");
+				nvmlShutdown();
+			}
+		} else {
+			printf("Warning: NVML initialization failed, power monitoring disabled\n");
+		}
+#endif
+	}
+
+	if (options->playlist) {
+		playing = true;
+		start_playlist();
+	}
+
+	if (governed) {
+		start_quality(source, current.program);
+		free(source);
+	}
+
+	if (options->watch) {
+		if (init_compiler(egl) || watch_file(file, shader_changed, NULL)) {
+			printf("Warning: failed to set up shader hot-reload\n");
+		}
+	}
+
+	egl->draw = draw_shadertoy;
+	egl->draw_slice = draw_shadertoy_slice;
+	if (still.enabled) {
+		egl->damage = damage_shadertoy;
+	}
+	if (interpolation.enabled) {
+		egl->present = present_shadertoy;
+	}
 
 	return 0;
 }
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <GLES3/gl3.h>
+
+#include "common.h"
+
+/* Module to upsample the image pass temporally: it is rendered at a reduced
+ * resolution, with a sub-pixel jitter that differs each frame, accumulated
+ * into a history at the full resolution, that is clamped to the current
+ * neighbourhood not to ghost on changes, and the history is presented.
+ */
+
+static struct {
+	struct shading_rate rate;
+	char *declarations;
+	// Full and reduced resolutions
+	int width, height;
+	int low_width, low_height;
+	struct framebuffer low;
+	struct framebuffer history[2];
+	unsigned latest;
+	bool reset;
+	const GLfloat *jitter;
+	GLuint accumulate, present;
+	GLint jitter_location, reset_location;
+	GLuint units[2];
+	// Jitter uniform of the image program
+	GLuint image_program;
+	GLint image_jitter;
+	int accumulate_timer, present_timer;
+} taau;
+
+static const char *taau_declarations =
+		"uniform vec2 kms_jitter;\n"
+		"#define kms_FragCoord ((gl_FragCoord.xy + kms_jitter) / vec2(%f, %f))\n";
+
+static const char *taau_accumulate_fs =
+		"#ifdef GL_FRAGMENT_PRECISION_HIGH                            \n"
+		"precision highp float;                                       \n"
+		"#else                                                        \n"
+		"precision mediump float;                                     \n"
+		"#endif                                                       \n"
+		"                                                             \n"
+		"uniform sampler2D current;                                   \n"
+		"uniform sampler2D history;                                   \n"
+		"uniform vec2 low;                                            \n"
+		"uniform vec2 scale;                                          \n"
+		"uniform vec2 jitter;                                         \n"
+		"uniform float reset;                                         \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    // The pixel in the jittered low resolution sample grid  \n"
+		"    vec2 s = gl_FragCoord.xy * scale - jitter;               \n"
+		"    if (reset > 0.5) {                                       \n"
+		"        gl_FragColor = texture2D(current, s / low);          \n"
+		"        return;                                              \n"
+		"    }                                                        \n"
+		"    vec2 texel = floor(s) + 0.5;                             \n"
+		"    vec4 color = texture2D(current, texel / low);            \n"
+		"    vec4 lo = color;                                         \n"
+		"    vec4 hi = color;                                         \n"
+		"    for (int y = -1; y <= 1; y++) {                          \n"
+		"        for (int x = -1; x <= 1; x++) {                      \n"
+		"            vec4 n = texture2D(current, (texel + vec2(x, y)) / low);\n"
+		"            lo = min(lo, n);                                 \n"
+		"            hi = max(hi, n);                                 \n"
+		"        }                                                    \n"
+		"    }                                                        \n"
+		"    // Clamp the history to the current neighbourhood, not  \n"
+		"    // to ghost on changes, and weight the current sample by \n"
+		"    // its distance to the pixel, in full resolution pixels  \n"
+		"    vec4 previous = clamp(texture2D(history, uv), lo, hi);   \n"
+		"    vec2 d = (s - texel) / scale;                            \n"
+		"    float alpha = mix(0.02, 0.2, exp(-2.0 * dot(d, d)));     \n"
+		"    gl_FragColor = mix(previous, color, alpha);              \n"
+		"}                                                            \n";
+
+static const char *taau_present_fs =
+		"precision mediump float;                                     \n"
+		"                                                             \n"
+		"uniform sampler2D history;                                   \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    gl_FragColor = texture2D(history, uv);                   \n"
+		"}                                                            \n";
+
+// Halton (2, 3) sequence, centered on the pixel
+static const GLfloat taau_jitter[][2] = {
+		{0.0f, -0.166667f}, {-0.25f, 0.166667f}, {0.25f, -0.388889f}, {-0.375f, -0.055556f},
+		{0.125f, 0.277778f}, {-0.125f, -0.277778f}, {0.375f, 0.055556f}, {-0.4375f, 0.388889f},
+};
+
+static void begin_taau(GLuint program, unsigned frame, const GLfloat mouse[4])
+{
+	(void) mouse;
+
+	// The history of another program is not accumulated
+	if (taau.image_program != program) {
+		taau.image_program = program;
+		taau.image_jitter = glGetUniformLocation(program, "kms_jitter");
+		taau.reset = true;
+	}
+
+	taau.jitter = taau_jitter[frame % ARRAY_SIZE(taau_jitter)];
+}
+
+static bool draw_taau(GLuint program, unsigned i)
+{
+	if (i > 0)
+		return false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, taau.low.fb);
+	glViewport(0, 0, taau.low_width, taau.low_height);
+	glUseProgram(program);
+	glUniform2fv(taau.image_jitter, 1, taau.jitter);
+
+	return true;
+}
+
+/* Accumulate the render into the history, and present the history */
+static void resolve_taau(GLuint target)
+{
+	unsigned next = !taau.latest;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, taau.history[next].fb);
+	glViewport(0, 0, taau.width, taau.height);
+	glUseProgram(taau.accumulate);
+	glUniform2fv(taau.jitter_location, 1, taau.jitter);
+	glUniform1f(taau.reset_location, taau.reset);
+	glActiveTexture(GL_TEXTURE0 + taau.units[0]);
+	glBindTexture(GL_TEXTURE_2D, taau.low.tex);
+	glActiveTexture(GL_TEXTURE0 + taau.units[1]);
+	glBindTexture(GL_TEXTURE_2D, taau.history[taau.latest].tex);
+	glActiveTexture(GL_TEXTURE0);
+	begin_gpu_timer(taau.accumulate_timer);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	end_gpu_timer(taau.accumulate_timer);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glUseProgram(taau.present);
+	glActiveTexture(GL_TEXTURE0 + taau.units[1]);
+	glBindTexture(GL_TEXTURE_2D, taau.history[next].tex);
+	glActiveTexture(GL_TEXTURE0);
+	begin_gpu_timer(taau.present_timer);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	end_gpu_timer(taau.present_timer);
+
+	taau.latest = next;
+	taau.reset = false;
+}
+
+/* Sets up the temporal upsampling of a width x height image pass, rendered
+ * at scale of the resolution, with the history in half floats when they
+ * are renderable, not to band while accumulating.
+ */
+const struct shading_rate *init_taau(int width, int height, float scale, bool half_float)
+{
+	int ret;
+
+	taau.width = width;
+	taau.height = height;
+	taau.low_width = MAX2(1, width * scale);
+	taau.low_height = MAX2(1, height * scale);
+
+	ret = create_quad_program(taau_accumulate_fs);
+	if (ret < 0)
+		return NULL;
+	taau.accumulate = ret;
+
+	ret = create_quad_program(taau_present_fs);
+	if (ret < 0)
+		return NULL;
+	taau.present = ret;
+
+	if (!create_offscreen_framebuffer(&taau.low, taau.low_width, taau.low_height,
+	                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE))
+		return NULL;
+	for (int i = 0; i < 2; i++) {
+		bool created = half_float &&
+		               create_offscreen_framebuffer(&taau.history[i], width, height,
+		                                            GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+		if (!created &&
+		    !create_offscreen_framebuffer(&taau.history[i], width, height,
+		                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE))
+			return NULL;
+	}
+
+	taau.units[0] = reserve_texture_unit();
+	taau.units[1] = reserve_texture_unit();
+
+	glUseProgram(taau.accumulate);
+	glUniform1i(glGetUniformLocation(taau.accumulate, "current"), taau.units[0]);
+	glUniform1i(glGetUniformLocation(taau.accumulate, "history"), taau.units[1]);
+	glUniform2f(glGetUniformLocation(taau.accumulate, "low"), taau.low_width, taau.low_height);
+	glUniform2f(glGetUniformLocation(taau.accumulate, "scale"),
+	            (float) taau.low_width / width, (float) taau.low_height / height);
+	taau.jitter_location = glGetUniformLocation(taau.accumulate, "jitter");
+	taau.reset_location = glGetUniformLocation(taau.accumulate, "reset");
+
+	glUseProgram(taau.present);
+	glUniform1i(glGetUniformLocation(taau.present, "history"), taau.units[1]);
+
+	taau.accumulate_timer = create_gpu_timer("taau accumulate");
+	taau.present_timer = create_gpu_timer("taau present");
+
+	asprintf(&taau.declarations, taau_declarations,
+	         (float) taau.low_width / width, (float) taau.low_height / height);
+
+	taau.reset = true;
+	taau.rate = (struct shading_rate) {
+			.declarations = taau.declarations,
+			.temporal = true,
+			.begin = begin_taau,
+			.draw = draw_taau,
+			.resolve = resolve_taau,
+	};
+
+	printf("Temporal upsampling from %dx%d\n", taau.low_width, taau.low_height);
+
+	return &taau.rate;
+}
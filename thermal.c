@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+/* Module to hold the temperature of the SoC below a limit, by lowering the
+ * rendering load before the firmware throttles the clocks, e.g. on passively
+ * cooled boards.  A thread samples the thermal zones, and the cpufreq and
+ * devfreq frequencies, from sysfs, extrapolates the temperature over a
+ * horizon, from its trend, and steps the load down while it would exceed
+ * the limit, or back up once it has cooled down.
+ *
+ * With the quality governor, the ceiling of its levels is lowered first,
+ * down to the lowest level, before the frame rate is capped, and raised
+ * back last.  The ceiling is applied by update_quality(), and the frame
+ * rate cap by wait_frame_cap(), on the render thread.
+ *
+ * The root of sysfs can be replaced with a directory tree, to run the
+ * governor against fake sensors, e.g. with thermal_zone0/temp files written
+ * by a script.
+ */
+
+#define SAMPLE_NS NSEC_PER_SEC
+/* Minimum time between changes, for the temperature to follow */
+#define DECISION_NS (5 * NSEC_PER_SEC)
+/* Horizon of the extrapolation of the temperature, in seconds */
+#define HORIZON 30.0
+/* Smoothing of the temperature trend, over the samples */
+#define SLOPE_WEIGHT 0.2
+/* Degrees below the limit, under which the cap is raised back */
+#define HYSTERESIS 3.0
+/* Steps of the cap, and its lowest share of the uncapped frame rate */
+#define DECREASE 0.9f
+#define INCREASE 1.05f
+#define MIN_SHARE 0.25f
+
+static struct {
+	bool enabled;
+	float limit;
+	/* user cap of the frame rate, if any */
+	float max_fps;
+	pthread_t thread;
+
+	glob_t zones;
+	glob_t cpufreqs;
+	glob_t devfreqs;
+
+	double temp;
+	double slope;
+	uint64_t sample_time;
+	uint64_t decision_time;
+
+	/* shared with the render thread */
+	pthread_mutex_t lock;
+	/* frame rate when not throttled, which follows mode changes */
+	float ceiling;
+	float fps;
+	bool changed;
+	/* quality levels of the quality governor, and the highest allowed */
+	unsigned levels;
+	unsigned level;
+
+	/* accumulated results */
+	unsigned samples;
+	double peak;
+	double over_time;
+	unsigned decisions;
+	unsigned cpu_samples, gpu_samples;
+	double cpu_total, gpu_total;
+} thermal = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool read_value(const char *dir, const char *name, double *value)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	bool ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	ret = fscanf(file, "%lf", value) == 1;
+	fclose(file);
+
+	return ret;
+}
+
+/* Mean ratio of the current to the maximum frequencies of the devices */
+static bool frequency_ratio(const glob_t *devices, const char *cur, const char *max, double *ratio)
+{
+	unsigned count = 0;
+	double total = 0;
+
+	for (size_t i = 0; i < devices->gl_pathc; i++) {
+		double cur_freq, max_freq;
+
+		if (read_value(devices->gl_pathv[i], cur, &cur_freq) &&
+		    read_value(devices->gl_pathv[i], max, &max_freq) && max_freq > 0) {
+			total += cur_freq / max_freq;
+			count++;
+		}
+	}
+
+	if (count)
+		*ratio = total / count;
+
+	return count > 0;
+}
+
+static void sample_thermal(uint64_t time)
+{
+	double temp = -1.0, value, cpu = -1.0, gpu = -1.0;
+
+	/* The hottest zone, in millidegrees */
+	for (size_t i = 0; i < thermal.zones.gl_pathc; i++) {
+		if (read_value(thermal.zones.gl_pathv[i], "temp", &value))
+			temp = MAX2(temp, value / 1000.0);
+	}
+	if (temp < 0)
+		return;
+
+	if (thermal.sample_time) {
+		double elapsed = (time - thermal.sample_time) / (double) NSEC_PER_SEC;
+
+		thermal.slope += SLOPE_WEIGHT * ((temp - thermal.temp) / elapsed - thermal.slope);
+		if (temp > thermal.limit)
+			thermal.over_time += elapsed;
+	}
+	thermal.temp = temp;
+	thermal.sample_time = time;
+	thermal.samples++;
+	thermal.peak = MAX2(thermal.peak, temp);
+
+	if (frequency_ratio(&thermal.cpufreqs, "scaling_cur_freq", "cpuinfo_max_freq", &cpu)) {
+		thermal.cpu_samples++;
+		thermal.cpu_total += cpu;
+	}
+	if (frequency_ratio(&thermal.devfreqs, "cur_freq", "max_freq", &gpu)) {
+		thermal.gpu_samples++;
+		thermal.gpu_total += gpu;
+	}
+
+	if (thermal.decision_time && time - thermal.decision_time < DECISION_NS)
+		return;
+
+	/* Only a rising trend anticipates the limit */
+	double predicted = temp + MAX2(thermal.slope, 0.0) * HORIZON;
+
+	pthread_mutex_lock(&thermal.lock);
+	float fps = thermal.fps;
+	unsigned level = thermal.level;
+
+	/* The quality is lowered before the frame rate, and restored after */
+	if (predicted > thermal.limit) {
+		if (level > 0)
+			level--;
+		else
+			fps = MAX2(fps * DECREASE, MIN_SHARE * thermal.ceiling);
+	} else if (predicted < thermal.limit - HYSTERESIS) {
+		if (fps < thermal.ceiling)
+			fps = MIN2(fps * INCREASE, thermal.ceiling);
+		else if (level + 1 < thermal.levels)
+			level++;
+	}
+	bool changed = fps != thermal.fps || level != thermal.level;
+	bool capped = fps < thermal.ceiling;
+
+	thermal.changed |= fps != thermal.fps;
+	thermal.fps = fps;
+	thermal.level = level;
+	pthread_mutex_unlock(&thermal.lock);
+
+	if (!changed)
+		return;
+
+	thermal.decision_time = time;
+	thermal.decisions++;
+
+	printf("Thermal: %.1f C, %+.2f C/s, ", temp, thermal.slope);
+	if (cpu >= 0)
+		printf("CPU at %.0f%% of max frequency, ", 100.0 * cpu);
+	if (gpu >= 0)
+		printf("GPU at %.0f%% of max frequency, ", 100.0 * gpu);
+	if (capped) {
+		printf("capping the frame rate at %.2f fps\n", fps);
+	} else if (level + 1 < thermal.levels) {
+		printf("limiting the quality to level %u/%u\n", level + 1, thermal.levels);
+	} else if (thermal.levels) {
+		printf("lifting the quality limit\n");
+	} else {
+		printf("lifting the frame rate cap\n");
+	}
+}
+
+static void *thermal_thread(void *arg)
+{
+	(void) arg;
+
+	for (;;) {
+		struct timespec ts = {
+				.tv_sec = SAMPLE_NS / NSEC_PER_SEC,
+				.tv_nsec = SAMPLE_NS % NSEC_PER_SEC,
+		};
+		nanosleep(&ts, NULL);
+
+		sample_thermal(get_time_ns());
+	}
+
+	return NULL;
+}
+
+/* Holds the temperature below options->thermal_limit, from the frame rate
+ * at refresh Hz, or max_fps when capped.
+ */
+int init_thermal(const struct options *options, float refresh, float max_fps)
+{
+	const char *root = options->sysfs_root ? options->sysfs_root : "/sys";
+	char pattern[PATH_MAX];
+
+	if (options->thermal_limit <= 0)
+		return 0;
+
+	snprintf(pattern, sizeof(pattern), "%s/class/thermal/thermal_zone*", root);
+	if (glob(pattern, 0, NULL, &thermal.zones)) {
+		printf("No thermal zones in %s, not governing the temperature\n", root);
+		return 0;
+	}
+	snprintf(pattern, sizeof(pattern), "%s/devices/system/cpu/cpufreq/policy*", root);
+	glob(pattern, 0, NULL, &thermal.cpufreqs);
+	snprintf(pattern, sizeof(pattern), "%s/class/devfreq/*", root);
+	glob(pattern, 0, NULL, &thermal.devfreqs);
+
+	thermal.limit = options->thermal_limit;
+	thermal.max_fps = max_fps;
+	thermal.ceiling = max_fps > 0 ? max_fps : refresh;
+	thermal.fps = thermal.ceiling;
+
+	if (pthread_create(&thermal.thread, NULL, thermal_thread, NULL)) {
+		printf("failed to start thermal governor thread\n");
+		return -1;
+	}
+	thermal.enabled = true;
+
+	printf("Holding %zu thermal zones below %.1f C, with %zu CPU and %zu devfreq frequencies\n",
+	       thermal.zones.gl_pathc, thermal.limit, thermal.cpufreqs.gl_pathc, thermal.devfreqs.gl_pathc);
+
+	return 0;
+}
+
+/* Follows a change of the refresh rate of the mode, when the uncapped frame
+ * rate is derived from it.
+ */
+void thermal_refresh_changed(float refresh)
+{
+	if (!thermal.enabled || thermal.max_fps > 0)
+		return;
+
+	pthread_mutex_lock(&thermal.lock);
+	/* the cap holds, as long as it is below the new refresh rate */
+	if (thermal.fps < thermal.ceiling) {
+		thermal.fps = MIN2(thermal.fps, refresh);
+		thermal.changed = true;
+	} else {
+		thermal.fps = refresh;
+	}
+	thermal.ceiling = refresh;
+	pthread_mutex_unlock(&thermal.lock);
+}
+
+/* Returns whether the frame rate cap changed, to max_fps, or to none for 0 */
+bool thermal_frame_cap(float *max_fps)
+{
+	bool changed;
+
+	if (!thermal.enabled || pthread_mutex_trylock(&thermal.lock))
+		return false;
+
+	changed = thermal.changed;
+	thermal.changed = false;
+	*max_fps = thermal.fps < thermal.ceiling ? thermal.fps : thermal.max_fps;
+	pthread_mutex_unlock(&thermal.lock);
+
+	return changed;
+}
+
+/* Lets the thermal governor limit the quality level, among count levels */
+void thermal_quality_levels(unsigned count)
+{
+	if (!thermal.enabled)
+		return;
+
+	pthread_mutex_lock(&thermal.lock);
+	thermal.levels = count;
+	thermal.level = count - 1;
+	pthread_mutex_unlock(&thermal.lock);
+}
+
+/* Returns whether the quality is governed, with the highest allowed level */
+bool thermal_quality_ceiling(unsigned *level)
+{
+	bool governed;
+
+	if (!thermal.enabled || pthread_mutex_trylock(&thermal.lock))
+		return false;
+
+	governed = thermal.levels > 0;
+	*level = thermal.level;
+	pthread_mutex_unlock(&thermal.lock);
+
+	return governed;
+}
+
+void dump_thermal(void)
+{
+	if (!thermal.enabled || !thermal.samples)
+		return;
+
+	pthread_mutex_lock(&thermal.lock);
+	printf("Thermal: %.1f C peak, %.0f s over %.1f C, %u changes, ending at %.2f fps",
+	       thermal.peak, thermal.over_time, thermal.limit, thermal.decisions, thermal.fps);
+	if (thermal.levels)
+		printf(" and quality level %u/%u", thermal.level + 1, thermal.levels);
+	printf("\n");
+	if (thermal.cpu_samples) {
+		printf("Thermal: CPU at %.0f%% of max frequency on average\n",
+		       100.0 * thermal.cpu_total / thermal.cpu_samples);
+	}
+	if (thermal.gpu_samples) {
+		printf("Thermal: GPU at %.0f%% of max frequency on average\n",
+		       100.0 * thermal.gpu_total / thermal.gpu_samples);
+	}
+	pthread_mutex_unlock(&thermal.lock);
+}
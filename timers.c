@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/* Module to measure the GPU time spent in render passes, using the
+ * GL_EXT_disjoint_timer_query extension.
+ *
+ * Call begin_gpu_timer() and end_gpu_timer() around the draws to measure,
+ * with the timer returned by create_gpu_timer().  Timers can't be nested,
+ * as a single time elapsed query can be active at a time.  Each timer has
+ * a ring of queries, whose results are collected once available, a few
+ * frames later, not to stall the pipeline.  Results spanning a disjoint
+ * operation, e.g. a GPU frequency change, are discarded.
+ */
+
+#define MAX_GPU_TIMERS 8
+#define NUM_QUERIES 4
+
+struct gpu_timer {
+	const char *name;
+	GLuint queries[NUM_QUERIES];
+	bool pending[NUM_QUERIES];
+	unsigned current;
+
+	/* accumulated results */
+	unsigned samples;
+	uint64_t elapsed_time;
+};
+
+static struct {
+	const struct egl *egl;
+	struct gpu_timer timers[MAX_GPU_TIMERS];
+	unsigned count;
+} gpu_timers;
+
+void init_gpu_timers(const struct egl *egl)
+{
+	if (gpu_timers.egl)
+		return;
+
+	if (!egl->glGenQueriesEXT) {
+		printf("GL_EXT_disjoint_timer_query is not supported, GPU times are unavailable\n");
+		return;
+	}
+
+	gpu_timers.egl = egl;
+}
+
+/* Returns the timer, or -1 when GPU times are unavailable */
+int create_gpu_timer(const char *name)
+{
+	struct gpu_timer *timer;
+
+	if (!gpu_timers.egl || gpu_timers.count == MAX_GPU_TIMERS)
+		return -1;
+
+	timer = &gpu_timers.timers[gpu_timers.count];
+	timer->name = name;
+	gpu_timers.egl->glGenQueriesEXT(NUM_QUERIES, timer->queries);
+
+	return gpu_timers.count++;
+}
+
+static void collect_query(struct gpu_timer *timer, unsigned i, bool wait)
+{
+	const struct egl *egl = gpu_timers.egl;
+	GLuint available = 0;
+	GLint disjoint = 0;
+	GLuint64 elapsed;
+
+	if (!wait) {
+		egl->glGetQueryObjectuivEXT(timer->queries[i], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (!available)
+			return;
+	}
+
+	egl->glGetQueryObjectui64vEXT(timer->queries[i], GL_QUERY_RESULT_EXT, &elapsed);
+	timer->pending[i] = false;
+
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint)
+		return;
+
+	timer->samples++;
+	timer->elapsed_time += elapsed;
+}
+
+void begin_gpu_timer(int id)
+{
+	struct gpu_timer *timer;
+
+	if (id < 0)
+		return;
+
+	timer = &gpu_timers.timers[id];
+	for (unsigned i = 0; i < NUM_QUERIES; i++) {
+		if (timer->pending[i])
+			collect_query(timer, i, false);
+	}
+
+	/* all the queries are in flight, wait for the oldest */
+	if (timer->pending[timer->current])
+		collect_query(timer, timer->current, true);
+
+	gpu_timers.egl->glBeginQueryEXT(GL_TIME_ELAPSED_EXT, timer->queries[timer->current]);
+}
+
+void end_gpu_timer(int id)
+{
+	struct gpu_timer *timer;
+
+	if (id < 0)
+		return;
+
+	timer = &gpu_timers.timers[id];
+	gpu_timers.egl->glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+	timer->pending[timer->current] = true;
+	timer->current = (timer->current + 1) % NUM_QUERIES;
+}
+
+void dump_gpu_timers(void)
+{
+	if (!gpu_timers.count)
+		return;
+
+	printf("GPU times:\n");
+	for (unsigned t = 0; t < gpu_timers.count; t++) {
+		struct gpu_timer *timer = &gpu_timers.timers[t];
+
+		for (unsigned i = 0; i < NUM_QUERIES; i++) {
+			if (timer->pending[i])
+				collect_query(timer, i, true);
+		}
+
+		printf("  %s: %.3f ms/frame over %u frames\n", timer->name,
+		       timer->samples ? timer->elapsed_time / (double) (NSEC_PER_SEC / MSEC_PER_SEC) / timer->samples : 0,
+		       timer->samples);
+	}
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include "common.h"
+
+/* Module to upscale the image pass spatially: it is rendered at a reduced
+ * resolution, that is upscaled to the frame with an edge-adaptive filter,
+ * from the render of the current frame only.
+ */
+
+#define UPSCALE_SHARPNESS 0.5
+
+static struct {
+	struct shading_rate rate;
+	char *declarations;
+	// Full and reduced resolutions
+	int width, height;
+	int low_width, low_height;
+	struct framebuffer low;
+	GLuint program;
+	GLuint unit;
+	int timer;
+} upscale;
+
+static const char *upscale_declarations =
+		"#define kms_FragCoord (gl_FragCoord.xy / vec2(%f, %f))\n";
+
+/* Edge-adaptive upscaler, after AMD FidelityFX Super Resolution 1: a Lanczos
+ * approximation over 12 taps, stretched along the edge direction, with
+ * deringing, followed by contrast adaptive sharpening in the same pass.
+ */
+static const char *upscale_fs =
+		"#ifdef GL_FRAGMENT_PRECISION_HIGH                            \n"
+		"precision highp float;                                       \n"
+		"#else                                                        \n"
+		"precision mediump float;                                     \n"
+		"#endif                                                       \n"
+		"                                                             \n"
+		"uniform sampler2D source;                                    \n"
+		"uniform vec2 size;                                           \n"
+		"uniform vec2 scale;                                          \n"
+		"uniform float sharpness;                                     \n"
+		"varying vec2 uv;                                             \n"
+		"                                                             \n"
+		"vec3 fetch(vec2 p)                                           \n"
+		"{                                                            \n"
+		"    return texture2D(source, (p + 0.5) / size).rgb;          \n"
+		"}                                                            \n"
+		"                                                             \n"
+		"float luma(vec3 c)                                           \n"
+		"{                                                            \n"
+		"    return dot(c, vec3(0.299, 0.587, 0.114));                \n"
+		"}                                                            \n"
+		"                                                             \n"
+		"// Accumulate the tap, rotated into the edge frame          \n"
+		"void tap(inout vec3 sum, inout float total, vec2 d, vec3 c,  \n"
+		"         vec2 dir, vec2 len2, float lob, float clp)          \n"
+		"{                                                            \n"
+		"    vec2 v = vec2(dot(d, dir), dot(d, vec2(-dir.y, dir.x))) * len2;\n"
+		"    float x2 = min(dot(v, v), clp);                          \n"
+		"    float wb = 0.4 * x2 - 1.0;                               \n"
+		"    float wa = lob * x2 - 1.0;                               \n"
+		"    float w = (1.5625 * wb * wb - 0.5625) * wa * wa;         \n"
+		"    sum += c * w;                                            \n"
+		"    total += w;                                              \n"
+		"}                                                            \n"
+		"                                                             \n"
+		"void main()                                                  \n"
+		"{                                                            \n"
+		"    vec2 pp = gl_FragCoord.xy * scale - 0.5;                 \n"
+		"    vec2 fp = floor(pp);                                     \n"
+		"                                                             \n"
+		"    // The 2x2 quad around the pixel, and its neighbours     \n"
+		"    vec3 c00 = fetch(fp);                                    \n"
+		"    vec3 c10 = fetch(fp + vec2(1.0, 0.0));                   \n"
+		"    vec3 c01 = fetch(fp + vec2(0.0, 1.0));                   \n"
+		"    vec3 c11 = fetch(fp + vec2(1.0, 1.0));                   \n"
+		"    vec3 cm0 = fetch(fp + vec2(-1.0, 0.0));                  \n"
+		"    vec3 cm1 = fetch(fp + vec2(-1.0, 1.0));                  \n"
+		"    vec3 c20 = fetch(fp + vec2(2.0, 0.0));                   \n"
+		"    vec3 c21 = fetch(fp + vec2(2.0, 1.0));                   \n"
+		"    vec3 c0m = fetch(fp + vec2(0.0, -1.0));                  \n"
+		"    vec3 c1m = fetch(fp + vec2(1.0, -1.0));                  \n"
+		"    vec3 c02 = fetch(fp + vec2(0.0, 2.0));                   \n"
+		"    vec3 c12 = fetch(fp + vec2(1.0, 2.0));                   \n"
+		"                                                             \n"
+		"    // Edge direction and strength, from the luma gradient  \n"
+		"    float l00 = luma(c00), l10 = luma(c10);                  \n"
+		"    float l01 = luma(c01), l11 = luma(c11);                  \n"
+		"    vec2 g = vec2(l10 - luma(cm0) + l11 - luma(cm1) +        \n"
+		"                  luma(c20) - l00 + luma(c21) - l01,         \n"
+		"                  l01 - luma(c0m) + l11 - luma(c1m) +        \n"
+		"                  luma(c02) - l00 + luma(c12) - l10);        \n"
+		"    float len = length(g);                                   \n"
+		"    vec2 dir = len > 0.0001 ? g / len : vec2(1.0, 0.0);      \n"
+		"    float edge = clamp(len, 0.0, 1.0);                       \n"
+		"                                                             \n"
+		"    // Sharpen across the edge, and smooth along it          \n"
+		"    float stretch = 1.0 / max(abs(dir.x), abs(dir.y));       \n"
+		"    vec2 len2 = vec2(1.0 + (stretch - 1.0) * edge, 1.0 - 0.5 * edge);\n"
+		"    float lob = 0.5 - 0.29 * edge;                           \n"
+		"    float clp = 1.0 / lob;                                   \n"
+		"                                                             \n"
+		"    vec3 sum = vec3(0.0);                                    \n"
+		"    float total = 0.0;                                       \n"
+		"    tap(sum, total, fp - pp, c00, dir, len2, lob, clp);      \n"
+		"    tap(sum, total, fp + vec2(1.0, 0.0) - pp, c10, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(0.0, 1.0) - pp, c01, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(1.0, 1.0) - pp, c11, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(-1.0, 0.0) - pp, cm0, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(-1.0, 1.0) - pp, cm1, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(2.0, 0.0) - pp, c20, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(2.0, 1.0) - pp, c21, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(0.0, -1.0) - pp, c0m, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(1.0, -1.0) - pp, c1m, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(0.0, 2.0) - pp, c02, dir, len2, lob, clp);\n"
+		"    tap(sum, total, fp + vec2(1.0, 2.0) - pp, c12, dir, len2, lob, clp);\n"
+		"                                                             \n"
+		"    // Dering to the range of the quad                       \n"
+		"    vec3 lo = min(min(c00, c10), min(c01, c11));             \n"
+		"    vec3 hi = max(max(c00, c10), max(c01, c11));             \n"
+		"    vec3 color = clamp(sum / total, lo, hi);                 \n"
+		"                                                             \n"
+		"    // Sharpen less where the contrast is already high      \n"
+		"    vec3 blur = texture2D(source, (pp + 0.5) / size).rgb;    \n"
+		"    float contrast = max(hi.r - lo.r, max(hi.g - lo.g, hi.b - lo.b));\n"
+		"    color += (color - blur) * sharpness * (1.0 - contrast);  \n"
+		"    gl_FragColor = vec4(clamp(color, lo, hi), 1.0);          \n"
+		"}                                                            \n";
+
+static void begin_upscale(GLuint program, unsigned frame, const GLfloat mouse[4])
+{
+	(void) program, (void) frame, (void) mouse;
+}
+
+static bool draw_upscale(GLuint program, unsigned i)
+{
+	(void) program;
+
+	if (i > 0)
+		return false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, upscale.low.fb);
+	glViewport(0, 0, upscale.low_width, upscale.low_height);
+
+	return true;
+}
+
+static void resolve_upscale(GLuint target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, upscale.width, upscale.height);
+	glUseProgram(upscale.program);
+	glActiveTexture(GL_TEXTURE0 + upscale.unit);
+	glBindTexture(GL_TEXTURE_2D, upscale.low.tex);
+	glActiveTexture(GL_TEXTURE0);
+	begin_gpu_timer(upscale.timer);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	end_gpu_timer(upscale.timer);
+}
+
+/* Sets up the upscaling of a width x height image pass, rendered at scale of
+ * the resolution.
+ */
+const struct shading_rate *init_upscale(int width, int height, float scale)
+{
+	int ret;
+
+	upscale.width = width;
+	upscale.height = height;
+	upscale.low_width = MAX2(1, width * scale);
+	upscale.low_height = MAX2(1, height * scale);
+
+	ret = create_quad_program(upscale_fs);
+	if (ret < 0)
+		return NULL;
+	upscale.program = ret;
+
+	if (!create_offscreen_framebuffer(&upscale.low, upscale.low_width, upscale.low_height,
+	                                  GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE))
+		return NULL;
+
+	upscale.unit = reserve_texture_unit();
+
+	glUseProgram(upscale.program);
+	glUniform1i(glGetUniformLocation(upscale.program, "source"), upscale.unit);
+	glUniform2f(glGetUniformLocation(upscale.program, "size"), upscale.low_width, upscale.low_height);
+	glUniform2f(glGetUniformLocation(upscale.program, "scale"),
+	            (float) upscale.low_width / width, (float) upscale.low_height / height);
+	glUniform1f(glGetUniformLocation(upscale.program, "sharpness"), UPSCALE_SHARPNESS);
+
+	upscale.timer = create_gpu_timer("upscale");
+
+	asprintf(&upscale.declarations, upscale_declarations,
+	         (float) upscale.low_width / width, (float) upscale.low_height / height);
+
+	upscale.rate = (struct shading_rate) {
+			.declarations = upscale.declarations,
+			.begin = begin_upscale,
+			.draw = draw_upscale,
+			.resolve = resolve_upscale,
+	};
+
+	printf("Upscaling from %dx%d\n", upscale.low_width, upscale.low_height);
+
+	return &upscale.rate;
+}
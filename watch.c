@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2026 Antonin Stefanutti <antonin.stefanutti@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "common.h"
+
+/* Module to watch a file for changes, using inotify.
+ *
+ * The parent directory is watched rather than the file itself, so that
+ * editors replacing the file on save (write to a temporary file, then
+ * rename) are supported as well as editors writing the file in place.
+ *
+ * The inotify fd is dispatched by the event loop, on the render thread.
+ */
+
+struct watch {
+	int fd;
+	char *dir;
+	char *name;
+	void (*callback)(const char *path, void *data);
+	const char *path;
+	void *data;
+};
+
+static void watch_events(int fd, void *data)
+{
+	struct watch *watch = data;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	ssize_t len = read(fd, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			printf("failed to read inotify events: %s\n", strerror(errno));
+		return;
+	}
+
+	bool changed = false;
+	for (char *ptr = buf; ptr < buf + len;) {
+		const struct inotify_event *event = (const struct inotify_event *) ptr;
+		if (event->len && strcmp(event->name, watch->name) == 0)
+			changed = true;
+		ptr += sizeof(struct inotify_event) + event->len;
+	}
+
+	if (changed)
+		watch->callback(watch->path, watch->data);
+}
+
+int watch_file(const char *path, void (*callback)(const char *path, void *data), void *data)
+{
+	struct watch *watch = calloc(1, sizeof(*watch));
+	char *dir = strdup(path), *name = strdup(path);
+
+	watch->dir = strdup(dirname(dir));
+	watch->name = strdup(basename(name));
+	watch->path = path;
+	watch->callback = callback;
+	watch->data = data;
+	free(dir);
+	free(name);
+
+	watch->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (watch->fd < 0) {
+		printf("failed to initialize inotify: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	if (inotify_add_watch(watch->fd, watch->dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("failed to watch '%s': %s\n", watch->dir, strerror(errno));
+		goto fail_close;
+	}
+
+	if (add_event_source(watch->fd, watch_events, watch)) {
+		printf("failed to watch inotify events: %s\n", strerror(errno));
+		goto fail_close;
+	}
+
+	printf("Watching %s for changes\n", path);
+
+	return 0;
+
+fail_close:
+	close(watch->fd);
+fail:
+	free(watch->dir);
+	free(watch->name);
+	free(watch);
+	return -1;
+}